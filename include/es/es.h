@@ -29,7 +29,9 @@
 //#include <es/es_event.h>
 #include <es/es_source.h>
 #include <es/es_queue.h>
+#include <es/es_executor.h>
 //#include <es/es_handler.h>
+#include <es/es_stream_handler.h>
 #include <es/es_sink.h>
 
 #include <es/es_handler.h>
@@ -0,0 +1,51 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of gr-eventstream
+ *
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef EVENTSTREAM_AFFINITY_H
+#define EVENTSTREAM_AFFINITY_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Thread placement helpers for the handler pools.
+ *
+ * Node numbers come from sysfs so no NUMA library is needed, -1 stands
+ * for unknown (no NUMA support, or a kernel without the node links).
+ */
+
+/*
+ * pin the calling thread to a set of cpus, warns and returns false if
+ * that fails.  threads pin themselves before touching any buffer so first
+ * touch places their memory on the set's node.
+ */
+bool es_set_thread_affinity(const std::vector<int> &cpus);
+
+// NUMA node a cpu belongs to
+int es_cpu_node(int cpu);
+
+// the cpus of the list on the same node as cpu, a thread's cpu set
+std::vector<int> es_node_cpus(const std::vector<int> &cpus, int cpu);
+
+// cpus as a comma separated list, for ControlPort
+std::string es_cpu_list(const std::vector<int> &cpus);
+
+#endif /* EVENTSTREAM_AFFINITY_H */
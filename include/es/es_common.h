@@ -43,6 +43,7 @@ class es {
         static pmt_t event_time;
         static pmt_t event_length;
         static pmt_t event_buffer;
+        static pmt_t event_deadline;
 
         // common event types
         static pmt_t event_type_1;
@@ -56,7 +57,24 @@ class es {
 enum es_search_behaviors {
     SEARCH_FORWARD,
     SEARCH_REVERSE,
-    SEARCH_BINARY
+    SEARCH_BINARY,
+    // keep the event queue as a binary min-heap on event time
+    // rather than a sorted vector (O(log n) insert and pop)
+    SEARCH_HEAP
+};
+
+// how handler work is spread over a block's thread pool
+enum es_scheduling_policies {
+    // every thread pops one shared queue
+    SCHEDULE_FIFO,
+    // a queue per thread, idle threads steal from the others
+    SCHEDULE_STEAL,
+    // a queue per thread chosen by the event's order key, events sharing
+    // a key run one at a time in time order
+    SCHEDULE_KEYED,
+    // one shared queue, the event with the earliest deadline (its
+    // es::event_deadline arg, else its time) runs first
+    SCHEDULE_EDF
 };
 
 bool is_event( pmt_t event );
@@ -77,6 +95,11 @@ pmt_t event_args_add( pmt_t evt, pmt_t arg_key, pmt_t arg_val );
 pmt_t eh_pair_event( pmt_t eh_pair );
 pmt_t eh_pair_handler( pmt_t eh_pair );
 
+// process wide interning of event type symbols into small integer ids,
+// ids are dense from 0 and stay valid for the life of the process
+int es_event_type_id( pmt_t type );
+pmt_t es_event_type_symbol( int id );
+
 pmt_t register_buffer( pmt_t event, pmt_t bufs);
 pmt_t register_buffer( pmt_t event, gr_vector_void_star buf, gr_vector_int &sig);
 //pmt_t register_buffer( pmt_t event, gr_vector_const_void_star buf, gr_vector_int &sig);
@@ -24,18 +24,62 @@
 
 #include <pmt/pmt.h>
 #include <gnuradio/block.h>
+#include <es/es_event.h>
 using namespace pmt;
 
+class es_handler;
+class es_stream_handler;
+class es_eh_pair_pool;
+
+/*
+ * bytes of one buffer copy charged to the sink's memory budget, shared by
+ * every pair holding the copy and given back when the last one is done.
+ * only the sink's work() thread touches it
+ */
+struct es_eh_charge {
+    uint64_t nbytes;
+    int refs;
+};
+
+/*
+ * completion record posted by the event loop threads back to the sink,
+ * the pair's hold on charge (if any) is released and if pinned the event
+ * held the input stream at time
+ */
+struct es_eh_done {
+    uint64_t time;
+    es_eh_charge* charge;
+    bool pinned;
+};
+
 class es_eh_pair {
 
     public:
-        es_eh_pair(pmt_t event, pmt_t handler);
-        pmt_t event;
-        pmt_t handler;
+        es_eh_pair(const es_event &event, es_handler* handler);
+
+        // storage comes from the given pool, or the heap if none is given,
+        // delete returns it to wherever it came from
+        static void* operator new(size_t sz);
+        static void* operator new(size_t sz, es_eh_pair_pool &pool);
+        static void operator delete(void* ptr);
+        static void operator delete(void* ptr, es_eh_pair_pool &pool);
+        static size_t slot_size();
+
+        es_event event;
+        es_handler* handler;
+        // set if handler takes the event incrementally
+        es_stream_handler* stream;
+
+        // bookkeeping for the sink, echoed back in es_eh_done
+        es_eh_charge* charge;
+        bool pinned;
 
         void run();
-        unsigned long long time();
-        unsigned long long length();
+
+        unsigned long long time(){ return event.time(); }
+        unsigned long long length(){ return event.length(); }
+        void set_time(uint64_t time){ event.set_time(time); }
+        es_eh_done done(){ es_eh_done d = { time(), charge, pinned }; return d; }
         ~es_eh_pair();
 
     private:
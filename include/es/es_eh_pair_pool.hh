@@ -0,0 +1,69 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ * 
+ * This file is part of gr-eventstream
+ * 
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef ES_EH_PAIR_POOL_HH
+#define ES_EH_PAIR_POOL_HH
+
+#include <boost/lockfree/stack.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/atomic.hpp>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * slab pool of es_eh_pair storage
+ *
+ * slots are carved out of slabs and recycled through a lock-free free
+ * list, so any thread may allocate or free a pair.  when the free list runs
+ * dry a new slab as large as the current capacity is added, so the pool
+ * settles at the observed peak number of live pairs and after that no
+ * allocation is done.  slabs are only returned when the pool is destroyed,
+ * every pair taken from it must be deleted before then.
+ *
+ * pairs are placed with new (pool) es_eh_pair(...) and freed with a plain
+ * delete, es_eh_pair::operator delete finds the owning pool itself.
+ */
+class es_eh_pair_pool {
+    public:
+        es_eh_pair_pool(size_t slab_size = 64);
+        ~es_eh_pair_pool();
+
+        void* acquire(size_t sz);
+        void release(void* slot);
+
+        uint64_t hits(){ return d_hits; }
+        uint64_t misses(){ return d_misses; }
+        uint64_t capacity(){ return d_capacity; }
+        uint64_t peak(){ return d_peak; }
+
+    private:
+        void grow(size_t n);
+
+        size_t d_slab_size;
+        boost::lockfree::stack<void*> d_free;
+        boost::mutex d_slab_lock;
+        std::vector<char*> d_slabs;
+
+        boost::atomic<uint64_t> d_hits, d_misses, d_capacity;
+        boost::atomic<uint64_t> d_outstanding, d_peak;
+};
+
+#endif
@@ -25,19 +25,58 @@
 #define EVENTSTREAM_EVENT_H
 
 #include <pmt/pmt.h>
-#include <gnuradio/block.h>
+#include <stdint.h>
 
 using namespace pmt;
 
-#include <es/es_queue.h>
+/*
+ * Native form of an eventstream event used inside the queue, sink and
+ * source. The core fields are plain members so scheduling never walks
+ * the event dict; the pmt tuple(type_es_event, dict) form handed to
+ * handlers and message ports is only built by to_pmt() and is cached
+ * until the event is modified again.
+ */
+class es_event {
 
-// event is a pmt
+    public:
+        es_event();
+        es_event(pmt_t type, uint64_t time, uint64_t length);
+        // parse a pmt event, throws if evt is not an event
+        explicit es_event(pmt_t evt);
 
+        pmt_t type() const { return d_type; }
+        // interned id of type(), see es_event_type_id()
+        int type_id() const { return d_type_id; }
+        uint64_t time() const { return d_time; }
+        uint64_t length() const { return d_length; }
+        pmt_t buffer() const { return d_buffer; }
 
+        void set_time(uint64_t time);
+        void set_buffer(pmt_t buf_list);
+        // buf_list points into owner, which is kept alive with the event
+        // but is not part of the pmt form
+        void set_buffer(pmt_t buf_list, pmt_t owner);
 
+        // non core fields
+        void add_arg(pmt_t key, pmt_t val);
+        bool has_arg(pmt_t key) const;
+        pmt_t arg(pmt_t key) const;
+        // dict merged over the args when the pmt form is built (stream tags)
+        void merge_args(pmt_t dict);
 
+        pmt_t to_pmt();
+        void print();
 
+    private:
+        pmt_t d_type;
+        int d_type_id;
+        uint64_t d_time;
+        uint64_t d_length;
+        pmt_t d_buffer;
+        pmt_t d_buffer_owner;
+        pmt_t d_args;
+        pmt_t d_merge;
+        pmt_t d_pmt;
+};
 
 #endif
-
-
@@ -0,0 +1,90 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of gr-eventstream
+ *
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef ES_EVENT_COUNTER_H
+#define ES_EVENT_COUNTER_H
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+
+/*
+ * count of outstanding events doubling as a completion barrier
+ *
+ * increments and decrements are plain atomics, only the decrement that
+ * reaches zero takes the lock, and only if somebody is waiting.  waiters
+ * announce themselves and re-check the count under the lock, so the last
+ * decrement can not be missed.
+ */
+class es_event_counter {
+    public:
+        es_event_counter(int n = 0) : d_count(n), d_waiters(0) {}
+
+        int operator++(){ return ++d_count; }
+        int operator++(int){ return d_count++; }
+        int operator--(){
+            int n = --d_count;
+            if(n == 0)
+                wake();
+            return n;
+        }
+        int operator--(int){ return operator--() + 1; }
+        operator int() const { return d_count; }
+
+        /*
+         * wait for the count to reach zero, for at most timeout_ms
+         * milliseconds unless that is 0, false if it timed out
+         */
+        bool wait_zero(int timeout_ms = 0){
+            if(d_count <= 0)
+                return true;
+
+            boost::chrono::steady_clock::time_point deadline =
+                boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout_ms);
+            boost::mutex::scoped_lock lock(d_lock);
+            d_waiters++;
+            while(d_count > 0){
+                if(timeout_ms <= 0){
+                    d_cond.wait(lock);
+                } else if(d_cond.wait_until(lock, deadline) == boost::cv_status::timeout){
+                    break;
+                }
+            }
+            d_waiters--;
+            return d_count <= 0;
+        }
+
+    private:
+        void wake(){
+            if(d_waiters > 0){
+                boost::mutex::scoped_lock lock(d_lock);
+                d_cond.notify_all();
+            }
+        }
+
+        boost::atomic<int> d_count;
+        boost::atomic<int> d_waiters;
+        boost::mutex d_lock;
+        boost::condition_variable d_cond;
+};
+
+#endif
@@ -23,6 +23,8 @@
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/lockfree/queue.hpp>
+#include <es/es_work_queue.h>
+#include <es/es_event_counter.h>
 #include <pmt/pmt.h>
 #include <es/es_queue.h>
 #include <es/es_common.h>
@@ -31,6 +33,27 @@
 
 using namespace pmt;
 
+/*
+ * live size of an autoscaled handler pool, a thread left idle for
+ * idle_ms retires itself while more than min_threads are live
+ */
+struct es_pool_size {
+    es_pool_size() : live(0), min_threads(0), idle_ms(0) {}
+
+    boost::atomic<int> live;
+    int min_threads;
+    int idle_ms;        // 0 never retires
+
+    bool try_retire(){
+        int n = live;
+        while(n > min_threads){
+            if(live.compare_exchange_weak(n, n-1))
+                return true;
+        }
+        return false;
+    }
+};
+
 class es_event_loop_thread {
 
     public:
@@ -39,15 +62,33 @@ class es_event_loop_thread {
         es_event_loop_thread(
             pmt_t _arb,
             es_queue_sptr _queue,
-            boost::lockfree::queue<es_eh_pair*> *qq,
-            boost::lockfree::queue<unsigned long long> *dq,
-            boost::condition *qq_cond,
-            boost::atomic<int> *nevents,
-            boost::atomic<uint64_t> *num_running_handlers);
+            es_work_queue<es_eh_pair*> *qq,
+            boost::lockfree::queue<es_eh_done> *dq,
+            es_event_counter *nevents,
+            boost::atomic<uint64_t> *num_running_handlers,
+            int lane = 0,
+            es_pool_size *pool = NULL,
+            std::vector<int> cpus = std::vector<int>());
         void start();
         void stop();
         void do_work();
-        boost::atomic<int> *d_nevents;
+
+        // a retired thread has left do_work() and only needs joining
+        bool exited(){ return d_exited; }
+        void join(){ d_thread->join(); }
+
+        // cpus the thread pinned itself to (given to the constructor),
+        // empty if it is not pinned, and their node
+        std::vector<int> cpus(){ return d_pinned ? d_cpus : std::vector<int>(); }
+        int lane(){ return d_lane; }
+        int node(){ return d_pinned ? d_node : -1; }
+
+        // run one pair and retire it, shared with es_executor clients
+        static void run_pair(es_eh_pair* eh,
+            boost::lockfree::queue<es_eh_done> *dq,
+            es_event_counter *nevents,
+            boost::atomic<uint64_t> *num_running_handlers);
+        es_event_counter *d_nevents;
         boost::atomic<uint64_t> *d_num_running_handlers;
 
     private:
@@ -59,10 +100,14 @@ class es_event_loop_thread {
 
         //boost::lockfree::queue<pmt_t*> *qq;
 
-        boost::condition *qq_cond;
-
-        boost::lockfree::queue<es_eh_pair*> *qq;
-        boost::lockfree::queue<unsigned long long> *dq;
+        es_work_queue<es_eh_pair*> *qq;
+        boost::lockfree::queue<es_eh_done> *dq;
+        int d_lane;     // our own lane in qq when work stealing
+        es_pool_size *d_pool;
+        boost::atomic<bool> d_exited;
+        const std::vector<int> d_cpus;
+        const int d_node;
+        boost::atomic<bool> d_pinned;
 
         void eh_run(pmt_t eh);
         sem_t* thread_notify_sem;
@@ -0,0 +1,106 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of gr-eventstream
+ *
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef EVENTSTREAM_EXECUTOR_H
+#define EVENTSTREAM_EXECUTOR_H
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
+#include <es/es_event_counter.h>
+#include <stdint.h>
+#include <vector>
+
+class es_executor;
+typedef boost::shared_ptr<es_executor> es_executor_sptr;
+
+es_executor_sptr es_make_executor(int n_threads);
+
+/*
+ * A block whose handler work can be run by an es_executor.
+ */
+class es_executor_client {
+    public:
+        virtual ~es_executor_client(){}
+
+        // run one queued work item if there is one, false when idle
+        virtual bool run_one() = 0;
+};
+
+/*
+ * Thread pool shared by any number of eventstream blocks.
+ *
+ * The pool size bounds how many handlers run at once across every
+ * attached block.  Workers visit the blocks round robin and take up to a
+ * block's weight of work items from it per visit, so a busy block gets a
+ * share proportional to its weight instead of starving the others.
+ * Blocks call notify() once for every work item they queue.
+ */
+class es_executor {
+    public:
+        es_executor(int n_threads);
+        ~es_executor();
+
+        // detach() returns once no worker is running work of the client,
+        // so it must not be called from a handler run by this executor
+        void attach(es_executor_client* client, int weight = 1);
+        void detach(es_executor_client* client);
+
+        void notify();
+
+        int n_threads(){ return d_threads.size(); }
+        uint64_t num_run(){ return d_num_run; }
+
+    private:
+        struct es_executor_entry {
+            es_executor_client* client;
+            int weight;
+            // workers inside the client's run_one(), detach() waits for 0
+            es_event_counter inflight;
+            boost::atomic<bool> detached;
+        };
+        typedef boost::shared_ptr<es_executor_entry> es_executor_entry_sptr;
+
+        void do_work();
+        int run_round(std::vector<es_executor_entry_sptr> &clients, unsigned int &version);
+
+        // workers keep their own copy of the list, refreshed when the
+        // version moves, and never hold the lock while running work
+        boost::shared_mutex d_clients_lock;
+        std::vector<es_executor_entry_sptr> d_clients;
+        boost::atomic<unsigned int> d_clients_version;
+        boost::atomic<unsigned int> d_cursor;
+
+        // bumped by every notify(), an idle worker parks until it moves
+        boost::atomic<unsigned int> d_epoch;
+        boost::atomic<int> d_waiters;
+        boost::atomic<uint64_t> d_num_run;
+        boost::mutex d_lock;
+        boost::condition_variable d_cond;
+        bool d_finished;
+
+        std::vector< boost::shared_ptr<boost::thread> > d_threads;
+};
+
+#endif /* EVENTSTREAM_EXECUTOR_H */
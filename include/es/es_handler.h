@@ -25,6 +25,7 @@
 #include <pmt/pmt.h>
 #include <gnuradio/msg_accepter.h>
 #include <gnuradio/sync_block.h>
+#include <es/es_event.h>
 
 using namespace pmt;
 
@@ -39,7 +40,13 @@ class es_handler : public virtual gr::sync_block
         es_handler();
         gr_vector_void_star get_buffer_ptr(pmt_t buffer_pmt);
         void handler_helper( pmt_t msg );
+        void handler_helper( es_event &evt );
         virtual void handler(pmt_t msg, gr_vector_void_star buf);
+
+        // true if handler() reads the event data only through buf and
+        // not through the event's buffer field, such handlers may be given
+        // views into the sink's buffers instead of u8vector copies
+        virtual bool native_buffers(){ return false; }
         ~es_handler();
         virtual int work (int noutput_items,
             gr_vector_const_void_star &input_items,
@@ -39,6 +39,7 @@ class es_handler_file : public es_handler {
         std::string d_path, d_desc;
         es_handler_file( DATATYPE type, std::string path, std::string desc );   
         void handler( pmt_t msg, gr_vector_void_star buf );
+        bool native_buffers(){ return true; }
         DATATYPE d_type;
 };
 
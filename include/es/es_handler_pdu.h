@@ -43,6 +43,7 @@ class es_handler_pdu : public es_handler {
         //void handler( pmt_t msg, void* buf );
 
         void handler( pmt_t msg, gr_vector_void_star buf );
+        bool native_buffers(){ return true; }
         DATATYPE d_type;
 };
 
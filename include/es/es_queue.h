@@ -25,6 +25,9 @@
 
 #include <gnuradio/block.h>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/atomic.hpp>
 #include <boost/bimap.hpp>
 #include <boost/function.hpp>
 
@@ -33,8 +36,10 @@ typedef boost::shared_ptr<es_queue> es_queue_sptr;
 
 
 #include <es/es_eh_pair.hh>
+#include <es/es_eh_pair_pool.hh>
 #include <es/es_event.h>
 #include <es/es_handler.h>
+#include <es/es_stream_handler.h>
 #include <es/es_common.h>
 
 enum es_queue_early_behaviors {
@@ -59,10 +64,14 @@ class es_queue {
         es_queue(
             enum es_queue_early_behaviors = DISCARD,
             enum es_search_behaviors = SEARCH_BINARY);
+        ~es_queue();
         int add_event(pmt_t evt);
+        int add_event(const es_event &evt);
         void print_queue(bool already_locked = false);
         int fetch_next_event(unsigned long long min, unsigned long long max, es_eh_pair **eh);
         int fetch_next_event2(unsigned long long min, unsigned long long max, es_eh_pair **eh);
+        int fetch_ready_events(unsigned long long min, unsigned long long max, std::vector<es_eh_pair*> &out);
+        void requeue_events(std::vector<es_eh_pair*> &events, size_t first);
 
         //int fetch_next_event(unsigned long long min, unsigned long long max, pmt_t &eh);
         //int fetch_next_event2(unsigned long long min, unsigned long long max, pmt_t &eh);
@@ -71,6 +80,7 @@ class es_queue {
         void bind_handler(std::string type, gr::basic_block_sptr handler);
         void bind_handler(std::string type, es_handler* handler);
         void bind_handler(pmt_t type, gr::basic_block_sptr handler);
+        void bind_handler(pmt_t type, es_handler* handler);
 
         void protect_handler(es_handler_sptr h){ protected_handler.push_back(h); }
 
@@ -91,14 +101,47 @@ class es_queue {
             }
 
 
-        bool empty(){ return event_queue.empty(); }
-        uint64_t min_time(){ return empty()?0: ::event_time(event_queue[0]->event); }
+        // storage for every eh pair created by add_event()
+        es_eh_pair_pool& pair_pool(){ return d_pair_pool; }
+
+        bool empty();
+        uint64_t min_time();
 
     private:
+        es_eh_pair_pool d_pair_pool;
         std::vector<es_eh_pair*> event_queue;
-        pmt_t bindings;
         boost::mutex queue_lock;
 
+        // heap backend only, events fetch_ready_events() found due but not
+        // yet complete, kept in time order outside the heap until they fit
+        std::vector<es_eh_pair*> d_soon;
+        void flush_soon();
+        uint64_t earliest_time();
+
+        // producers (add_event) only push here, the consumer binds and
+        // merges the staged pairs into event_queue under queue_lock when
+        // it fetches.  a pair with no handler is an event still to bind
+        boost::lockfree::queue<es_eh_pair*> d_staged;
+        boost::atomic<int> d_num_staged;
+        void merge_staged();
+        void bind_pairs(es_eh_pair* staged, std::vector<es_eh_pair*> &out);
+
+        // handlers bound to each event type, indexed by es_event_type_id()
+        boost::shared_mutex d_bindings_lock;
+        std::vector< std::vector<es_handler*> > d_bindings;
+        // streaming interface of each binding, NULL for ordinary handlers
+        std::vector< std::vector<es_stream_handler*> > d_stream_bindings;
+        std::vector<bool> d_registered;
+        bool type_registered(int type_id);
+
+        // number of handlers bound to each type id, -1 if it is not
+        // registered, republished as a new copy whenever the bindings
+        // change so add_event() can check an event's type without a lock.
+        // bindings only ever grow, old copies are kept until the queue goes
+        boost::atomic<const std::vector<int>*> d_handler_counts;
+        std::vector< boost::shared_ptr< std::vector<int> > > d_handler_counts_copies;
+        void publish_handler_counts();
+
         std::vector< es_handler_sptr > protected_handler;
         std::vector< boost::function< bool (es_eh_pair**) > > cb_list;
 
@@ -110,6 +153,12 @@ class es_queue {
         size_t find_forward(const uint64_t evt_time);
         size_t find_reverse(const uint64_t evt_time);
         size_t find_binary(const uint64_t evt_time);
+
+        // storage backend helpers, dispatch on d_search_behavior
+        void queue_insert(es_eh_pair* eh);
+        void queue_pop_front();
+        es_eh_pair* queue_take_first(unsigned long long max, bool whole_event);
+        void queue_reschedule_front(uint64_t time);
 };
 
 
@@ -0,0 +1,71 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of gr-eventstream
+ *
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef EVENTSTREAM_RING_BUFFER_H
+#define EVENTSTREAM_RING_BUFFER_H
+
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+#include <stddef.h>
+
+class es_ring_buffer;
+typedef boost::shared_ptr<es_ring_buffer> es_ring_buffer_sptr;
+
+/*
+ * Ring of stream items indexed by absolute item number.
+ *
+ * The same memory is mapped twice back to back, so any run of up to
+ * capacity() items starting anywhere in the ring is contiguous and can be
+ * handed out as a plain pointer without wrap handling.  Optionally backed
+ * by huge pages, falling back to normal pages if none can be had.
+ */
+class es_ring_buffer {
+    public:
+        es_ring_buffer(size_t itemsize, uint64_t min_items, bool hugepages = false);
+        ~es_ring_buffer();
+
+        // append n items, the oldest items are overwritten once full
+        void push(const void* items, uint64_t n);
+
+        // pointer to absolute item number item, valid for capacity() items
+        // and until that item is overwritten
+        const uint8_t* at(uint64_t item) const;
+
+        uint64_t capacity() const { return d_capacity; }
+        // first and one past the last item currently held
+        uint64_t start() const { return (d_end - d_first > d_capacity) ? d_end - d_capacity : d_first; }
+        uint64_t end() const { return d_end; }
+
+        // the first item pushed, items are numbered from here
+        void set_first(uint64_t item){ d_first = d_end = item; }
+
+    private:
+        size_t d_itemsize;
+        size_t d_nbytes;
+        uint64_t d_capacity;
+        uint64_t d_first;
+        uint64_t d_end;
+        uint8_t* d_base;
+        bool map(size_t nbytes, bool hugepages);
+};
+
+#endif /* EVENTSTREAM_RING_BUFFER_H */
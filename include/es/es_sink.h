@@ -29,8 +29,12 @@
 #include <es/es_event_loop_thread.hh>
 #include <es/es_eh_pair.hh>
 #include <es/es_event_acceptor.h>
+#include <es/es_ring_buffer.h>
+#include <es/es_executor.h>
 #include <boost/lockfree/queue.hpp>
 #include <semaphore.h>
+#include <map>
+#include <deque>
 
 #include <gnuradio/top_block.h>
 
@@ -50,19 +54,33 @@ enum es_congestion_behaviors {
             BLOCK
 };
 
+/*
+ * queue_capacity bounds the events waiting for a handler thread, past it
+ * the congestion behavior applies.  it must be at least 1.
+ */
 es_sink_sptr es_make_sink (
     gr_vector_int insig,
     int n_threads,
     int sample_history_in_kilosamples=64,
     enum es_queue_early_behaviors = DISCARD,
     enum es_search_behaviors = SEARCH_BINARY,
-    enum es_congestion_behaviors = DROP);
+    enum es_congestion_behaviors = DROP,
+    enum es_scheduling_policies = SCHEDULE_FIFO,
+    int queue_capacity = 100);
 
 //class es_sink :  public virtual gr::sync_block, public es_event_acceptor
-class es_sink :  public virtual es_handler, public virtual es_event_acceptor
+class es_sink :  public virtual es_handler, public virtual es_event_acceptor, public es_executor_client
 {
 private:
-  pmt::pmt_t latest_tags;
+  /*
+   * stream tags of all inputs ordered by offset, so the tags of any window
+   * are found with one binary search.  only the last tag before the
+   * buffer window is kept of the older ones.
+   */
+  std::deque<gr::tag_t> d_tag_index;
+  uint64_t d_tag_horizon;   // tags before this offset are already indexed
+  void index_tags(std::vector<gr::tag_t> &tags, uint64_t range_end, uint64_t min_time);
+  pmt::pmt_t tags_in(uint64_t start, uint64_t end);
 
   //New constructor with user-selectable sample history.
   friend es_sink_sptr es_make_sink (
@@ -71,14 +89,18 @@ private:
     int sample_history_in_kilosamples,
     enum es_queue_early_behaviors,
     enum es_search_behaviors,
-    enum es_congestion_behaviors);
+    enum es_congestion_behaviors,
+    enum es_scheduling_policies,
+    int queue_capacity);
   es_sink (
     gr_vector_int insig,
     int n_threads,
     int sample_history_in_kilosamples=64,
     enum es_queue_early_behaviors = DISCARD,
     enum es_search_behaviors = SEARCH_BINARY,
-    enum es_congestion_behaviors = DROP);  // private constructor
+    enum es_congestion_behaviors = DROP,
+    enum es_scheduling_policies = SCHEDULE_FIFO,
+    int queue_capacity = 100);  // private constructor
   void handler(pmt_t msg, gr_vector_void_star buf);
 
  public:
@@ -99,27 +121,183 @@ private:
   uint64_t event_time();
   uint64_t num_running_handlers();
   uint64_t event_queue_size();
+  uint64_t inflight_bytes();
+  uint64_t pair_pool_hits();
+  uint64_t pair_pool_misses();
+  uint64_t num_steals();
   double event_run_ratio();
   double event_thread_utilization();
 
+  /*
+   * bound the bytes of copied event buffers waiting for or in a handler,
+   * 0 (default) holds the input stream until the oldest event has been
+   * handled, otherwise the stream is consumed as soon as events are copied
+   * and new events are only dispatched while under the budget
+   */
+  void set_memory_budget(uint64_t nbytes){ d_memory_budget = nbytes; }
+  uint64_t memory_budget(){ return d_memory_budget; }
+
+  /*
+   * events of a zero-copy type are handed pointers straight into the input
+   * buffer instead of owned u8vector copies, the stream is held at the
+   * event until its handler returns regardless of the memory budget.
+   * handlers of these types must not keep the buffer past handler().
+   * only handlers declaring native_buffers() are given views, the other
+   * handlers of the type still get copies.
+   */
+  void set_zero_copy(std::string type, bool enable = true);
+
+  /*
+   * handlers of an inline type are run by work() itself as soon as their
+   * event is ready instead of being passed to the thread pool, meant for
+   * handlers cheaper than the hand-off.  with n_threads of 0 and no
+   * executor every event runs inline.
+   */
+  void set_inline(std::string type, bool enable = true);
+
+  /*
+   * with SCHEDULE_KEYED, events carrying the arg field run one at a time
+   * in time order per value of it and in parallel across values, events
+   * without it are unordered.  must be called before the flowgraph is
+   * started.
+   */
+  void set_order_key(std::string field){ d_order_key = pmt::intern(field); }
+
+  /*
+   * let the handler pool grow up to max_threads while every thread is
+   * busy and events keep queueing, threads idle for idle_ms retire down
+   * to min_threads (at least 1).  n_threads is the starting size, a
+   * max_threads of 0 turns autoscaling off.  only the shared queue
+   * policies (FIFO, EDF) scale, must be called before the flowgraph is
+   * started.
+   */
+  void set_thread_limits(int min_threads, int max_threads, int idle_ms = 500);
+  int num_threads();
+
+  /*
+   * pin handler threads to the given cpus, thread i to the set of them on
+   * the NUMA node of cpus[i % cpus.size()].  with localize work() itself
+   * is pinned to the first cpu's node, where it copies event buffers,
+   * and every event goes to the lane of a thread on that node so the one
+   * copy is local to the handler.  that needs a lane per thread, a fixed
+   * size FIFO pool is given work-stealing lanes (with a warning), keyed
+   * and EDF pools keep their own order.  must be called before the
+   * flowgraph is started.
+   */
+  void set_thread_affinity(std::vector<int> cpus, bool localize = false);
+  // cpus/node of every handler thread, for ControlPort
+  std::string thread_placement();
+
+  /*
+   * copy the union of overlapping or adjacent event windows once and hand
+   * each event an offset view into it, events sharing a span get their
+   * buffers as pointers rather than u8vectors just like zero-copy types.
+   * only handlers declaring native_buffers() share spans, the others
+   * keep getting a u8vector copy of their own window.
+   */
+  void set_coalesce_windows(bool enable){ d_coalesce = enable; }
+  bool coalesce_windows(){ return d_coalesce; }
+
+  /*
+   * keep the last nitems of every input in a double mapped ring owned by
+   * the sink, so events can start that far in the past without growing
+   * the upstream buffers through set_history.  events whose data comes
+   * from the ring are always copied and never hold the stream.  0 turns
+   * the ring off.  must be called before the flowgraph is started.
+   */
+  void set_external_history(uint64_t nitems, bool hugepages = false);
+  uint64_t external_history();
+
+  /*
+   * run handlers on a shared executor instead of n_threads threads of our
+   * own, taking up to weight events per visit of its workers.  must be
+   * called before the flowgraph is started, a null executor goes back to
+   * a private pool.
+   */
+  void set_executor(es_executor_sptr executor, int weight = 1);
+  bool run_one();
+
   unsigned long long d_time;
   unsigned int d_history;
   int n_threads;
   int sample_history_in_kilosamples;
 
-  boost::atomic<int> d_nevents;
-  void wait_events();
+  // events handed to handlers and not yet finished
+  es_event_counter d_nevents;
+  /*
+   * block until every handed out event has finished, or for at most
+   * timeout_ms milliseconds unless that is 0, false if it timed out
+   */
+  bool wait_events(int timeout_ms = 0);
 //  void wait_events(gr_top_block_sptr tb);
 
 //  sem_t thread_notify_sem;
-  boost::condition qq_cond;
-
-  boost::lockfree::queue<es_eh_pair*> qq;
-  boost::lockfree::queue<unsigned long long> dq;
+  es_work_queue<es_eh_pair*> qq;
+  boost::lockfree::queue<es_eh_done> dq;
 
   std::vector<boost::shared_ptr<es_event_loop_thread> > threadpool;
-  std::vector<uint64_t> live_event_times;
+  // times of events handed to the threadpool but not yet finished,
+  // counted since several events may start on the same sample
+  std::map<uint64_t,int> live_event_times;
+
+ private:
+  std::vector<es_eh_pair*> d_ready;   // events fetched per work() call
+
+  // buffers extracted in this work() call keyed by (time, length), so
+  // every handler bound to the same event shares one read-only copy
+  typedef std::pair<uint64_t,uint64_t> es_sink_window;
+  struct es_sink_window_buf {
+    pmt_t buf;
+    es_eh_charge* charge;
+  };
+  es_eh_charge* new_charge(uint64_t nbytes);
+  void release_charge(es_eh_charge* charge);
+  std::map<es_sink_window, es_sink_window_buf> d_window_bufs;
+
+  // contiguous copies planned over the ready events when coalescing
+  struct es_sink_span {
+    uint64_t start;
+    uint64_t end;
+    bool single;    // every event on the span covers all of it
+    es_sink_window_buf copy;
+  };
+  std::vector<es_sink_span> d_spans;
+  std::vector<int> d_span_of;   // span of each d_ready entry, -1 for none
+  void plan_spans(gr_vector_const_void_star &input_items);
+  size_t admit_events(size_t ninputs, uint64_t budget);
+
+  // external history rings, one per input, filled up to d_ring_horizon
+  std::vector<es_ring_buffer_sptr> d_rings;
+  uint64_t d_ring_horizon;
+  uint64_t d_gr_min_time;   // first item of this work() call's input_items
+  void ring_append(gr_vector_const_void_star &input_items, uint64_t max_time);
+  const uint8_t* item_ptr(int i, uint64_t item, gr_vector_const_void_star &input_items);
+
+  // events bound to an es_stream_handler which have begun but not ended,
+  // with the next item each still has to be given
+  struct es_sink_stream {
+    es_eh_pair* eh;
+    uint64_t pos;
+  };
+  std::vector<es_sink_stream> d_streams;
+  void begin_stream(es_eh_pair* eh);
+  void service_streams(gr_vector_const_void_star &input_items, uint64_t max_time, bool flush);
+  bool zero_copy_type(int type_id){
+    return type_id >= 0 && (size_t)type_id < d_zero_copy_work.size() && d_zero_copy_work[type_id];
+  }
+  // only handlers reading buf itself can take a bare pointer, the rest
+  // still find a u8vector in the event's buffer field.  data read out of
+  // the external ring is always copied
+  bool zero_copy_pair(es_eh_pair* eh){
+    return zero_copy_type(eh->event.type_id()) && eh->handler->native_buffers() &&
+        (d_rings.empty() || eh->time() >= d_gr_min_time);
+  }
+  bool inline_type(int type_id){
+    return (n_threads == 0 && !d_executor) ||
+        (type_id >= 0 && (size_t)type_id < d_inline_work.size() && d_inline_work[type_id]);
+  }
 
+ public:
   bool state_done_prevent_exit() { return (d_nevents + event_queue->length())!=0; }
   bool state_done_call_empty() { return (d_nevents + event_queue->length())!=0; }
   //bool state_done_prevent_exit() { return false; }
@@ -131,23 +309,51 @@ private:
 
   private:
     uint64_t d_buffer_window_size;
+    boost::atomic<uint64_t> d_memory_budget;
+    uint64_t d_inflight_bytes;
+
+    // zero-copy and inline flags indexed by es_event_type_id(), work()
+    // reads a snapshot taken whenever a setter has changed them
+    boost::mutex d_type_flags_lock;
+    std::vector<bool> d_zero_copy;
+    std::vector<bool> d_zero_copy_work;
+    std::vector<bool> d_inline;
+    std::vector<bool> d_inline_work;
+    boost::atomic<bool> d_type_flags_changed;
+    boost::atomic<bool> d_coalesce;
     boost::atomic<uint64_t> d_num_running_handlers;
     acc_avg_t d_avg_ratio;
     acc_avg_t d_avg_thread_utilization;
+    boost::mutex d_utilization_lock;
 
     /**
      * @brief Configuration variable for selecting an insertion sort algorithm.
      */
     es_search_behaviors d_search_behavior;
-    int find_index(const uint64_t& evt_time);
-    size_t find_forward(const uint64_t& evt_time);
-    size_t find_reverse(const uint64_t& evt_time);
-    size_t find_binary(const uint64_t& evt_time);
     /**
      * @brief Configuration variable for defining behavior when queue is full.
      */
     es_congestion_behaviors d_congestion_behavior;
 
+    es_executor_sptr d_executor;
+    int d_executor_weight;
+
+    es_scheduling_policies d_scheduling_policy;
+    pmt_t d_order_key;
+    int order_lane(es_event &event);
+
+    es_pool_size d_pool;
+    int d_max_threads;
+    void spawn_thread();
+    void autoscale(bool full = false);
+
+    std::vector<int> d_cpus;
+    bool d_localize;
+    std::vector< std::vector<int> > d_node_lanes;   // lanes of each node's threads
+    int d_work_node;    // node work() is pinned to when localizing
+    unsigned int d_node_next;
+    int local_lane();
+    boost::mutex d_threadpool_lock;   // threadpool changes vs ControlPort reads
 
 
 };
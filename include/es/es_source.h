@@ -27,9 +27,11 @@
 #include <es/es_queue.h>
 #include <es/es_source_thread.hh>
 #include <es/es_event_acceptor.h>
+#include <es/es_executor.h>
 #include <functional>
 #include <boost/function.hpp>
 #include <boost/lockfree/queue.hpp>
+#include <boost/thread/tss.hpp>
 
 
 class es_source;
@@ -37,14 +39,19 @@ using namespace pmt;
 
 typedef boost::shared_ptr<es_source> es_source_sptr;
 
-es_source_sptr es_make_source (gr_vector_int out_sig, int nthreads=1, enum es_queue_early_behaviors = DISCARD);
+/*
+ * queue_capacity is the number of events waiting for a handler thread the
+ * queue is sized for up front, it grows past that as needed.  it must be
+ * at least 1.
+ */
+es_source_sptr es_make_source (gr_vector_int out_sig, int nthreads=1, enum es_queue_early_behaviors = DISCARD, enum es_scheduling_policies = SCHEDULE_FIFO, int queue_capacity = 100);
 
-class es_source : public virtual gr::sync_block, public virtual es_event_acceptor
+class es_source : public virtual gr::sync_block, public virtual es_event_acceptor, public es_executor_client
 {
 private:
-  friend es_source_sptr es_make_source (gr_vector_int out_sig, int nthreads, enum es_queue_early_behaviors);
+  friend es_source_sptr es_make_source (gr_vector_int out_sig, int nthreads, enum es_queue_early_behaviors, enum es_scheduling_policies, int queue_capacity);
 
-  es_source (gr_vector_int out_sig, int nthreads=1, enum es_queue_early_behaviors = DISCARD);  	// private constructor
+  es_source (gr_vector_int out_sig, int nthreads=1, enum es_queue_early_behaviors = DISCARD, enum es_scheduling_policies = SCHEDULE_FIFO, int queue_capacity = 100);  	// private constructor
 
   es_handler_sptr ih;
 
@@ -57,13 +64,27 @@ private:
 
   void set_max(unsigned long long maxlen);
 
-  boost::condition qq_cond;
+  /*
+   * hand handler work to a shared executor, taking up to weight events
+   * per visit of its workers, and shut down our own handler threads
+   */
+  void set_executor(es_executor_sptr executor, int weight = 1);
+  bool run_one();
+
+  /*
+   * handlers of an inline type run inside the append callback instead of
+   * on a handler thread, with nthreads of 0 and no executor every
+   * event runs inline
+   */
+  void set_inline(std::string type, bool enable = true);
 
-  boost::lockfree::queue<es_eh_pair*> qq;        // work items to start
-  boost::lockfree::queue<unsigned long long> dq; // finished time indexes
+  // pin handler thread i to the given cpus on the node of cpus[i % cpus.size()]
+  void set_thread_affinity(std::vector<int> cpus);
+
+  es_work_queue<es_eh_pair*> qq;        // work items to start
 
   boost::mutex lin_mut;
-  std::vector<pmt_t> readylist;
+  std::vector<es_event> readylist;
 
   std::vector<boost::shared_ptr<es_source_thread> > threadpool;
 //  std::vector<unsigned long long> live_event_times;
@@ -72,6 +93,13 @@ private:
   bool cb(es_eh_pair** eh);
  
   int n_threads;   
+  gr_vector_int d_out_sig;
+
+  es_executor_sptr d_executor;
+  boost::mutex d_inline_lock;
+  std::vector<bool> d_inline;   // indexed by es_event_type_id()
+  bool inline_type(int type_id);
+  boost::thread_specific_ptr< std::vector<char> > d_zerobuf;  // per executor worker
 
   unsigned long long d_maxlen;
   unsigned long long d_time;
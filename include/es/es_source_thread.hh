@@ -23,6 +23,7 @@
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/lockfree/queue.hpp>
+#include <es/es_work_queue.h>
 #include <pmt/pmt.h>
 #include <es/es_queue.h>
 #include <es/es_common.h>
@@ -36,11 +37,21 @@ class es_source_thread {
     public:
     
         //es_source_thread();
-        es_source_thread(pmt_t _arb, es_queue_sptr _queue, boost::lockfree::queue<es_eh_pair*> *qq, boost::mutex *_lin_mut, std::vector<pmt_t> *_readylist, boost::condition *qq_cond, gr_vector_int out_sig);
+        es_source_thread(pmt_t _arb, es_queue_sptr _queue, es_work_queue<es_eh_pair*> *qq, boost::mutex *_lin_mut, std::vector<es_event> *_readylist, gr_vector_int out_sig, int lane = 0);
         void start();
         void stop();
         void do_work();
 
+        // pin to a set of cpus, output buffers are then allocated on their
+        // node, the thread pins itself before it runs its next event
+        void set_affinity(const std::vector<int> &cpus);
+
+        // fill in output buffers, run one pair and post its event to the
+        // readylist, shared with es_executor clients
+        static void run_pair(es_eh_pair* eh, gr_vector_int &out_sig,
+            std::vector<char> &zerobuf, boost::mutex *lin_mut,
+            std::vector<es_event> *readylist);
+
         std::vector<char> zerobuf;
 
     private:
@@ -53,11 +64,14 @@ class es_source_thread {
 
         //boost::lockfree::queue<pmt_t*> *qq;
 
-        boost::condition *qq_cond;
-
         boost::mutex *lin_mut;
-        std::vector<pmt_t>  *readylist;
-        boost::lockfree::queue<es_eh_pair*> *qq;
+        std::vector<es_event>  *readylist;
+        es_work_queue<es_eh_pair*> *qq;
+        int d_lane;     // our own lane in qq when work stealing
+        boost::mutex d_cpus_lock;
+        std::vector<int> d_cpus;
+        boost::atomic<int> d_cpus_gen;  // bumped by every set_affinity()
+        int d_pinned_gen;   // d_cpus_gen the thread last pinned itself for
 //        boost::lockfree::queue<unsigned long long> *dq;
 
         void eh_run(pmt_t eh);
@@ -0,0 +1,49 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of gr-eventstream
+ *
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef EVENTSTREAM_STREAM_HANDLER_H
+#define EVENTSTREAM_STREAM_HANDLER_H
+
+#include <gnuradio/types.h>
+#include <es/es_event.h>
+
+/*
+ * Interface for handlers which take their event incrementally.
+ *
+ * An es_handler which also derives from es_stream_handler is fed by
+ * es_sink as samples arrive instead of once the whole window is resident,
+ * so events may be longer than the sink history.  The callbacks run in the
+ * sink's work thread: begin once when the event start is reached, chunk
+ * for every run of new samples in order, then end.  Chunk buffers point
+ * into the input stream and are only valid during the call.
+ */
+class es_stream_handler {
+    public:
+        virtual ~es_stream_handler(){}
+
+        virtual void stream_begin(es_event &evt) = 0;
+        // nitems samples of every input starting offset items into evt
+        virtual void stream_chunk(es_event &evt, uint64_t offset,
+            gr_vector_const_void_star &buf, int nitems) = 0;
+        virtual void stream_end(es_event &evt) = 0;
+};
+
+#endif
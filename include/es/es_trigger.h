@@ -53,12 +53,13 @@ class es_trigger : public virtual gr::sync_block
 
   virtual bool start(){
 //        std::cout << "es_trigger::start() << " << name() << "\n";
-        for(int i=0; i< event_types.size(); i++){
+        for(size_t i=0; i< event_types.size(); i++){
             pmt::pmt_t reg = pmt::cons(event_types[i], message_subscribers(event_types[i]));
             reg = pmt::cons(pmt::mp("ES_REGISTER_HANDLER"), reg);
             message_port_pub(pmt::mp("which_stream"), reg);
 //            std::cout << "sent registeration message: " << reg << "\n";
             }
+        return true;
         }
   
   std::vector<pmt_t> event_types;
@@ -0,0 +1,309 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of gr-eventstream
+ *
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef ES_WORK_QUEUE_H
+#define ES_WORK_QUEUE_H
+
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <es/es_common.h>
+
+/*
+ * blocking multi-producer multi-consumer queue of work items
+ *
+ * items move through lock-free queues, the mutex and condition are only
+ * touched when a consumer has run out of work and parks.  a consumer
+ * announces itself in d_waiters and checks the queues again under the
+ * lock before sleeping, producers notify under the same lock whenever
+ * anyone is announced, so a push can never slip between the check and
+ * the wait and be left unseen (an eventcount).  consumers spin briefly
+ * before parking so a busy pool never pays for the syscalls.
+ *
+ * with SCHEDULE_STEAL each consumer owns a lane, producers deal items
+ * round robin over the lanes and a consumer whose lane is empty steals
+ * from the others before parking, so consumers mostly do not share a
+ * queue head.  with SCHEDULE_KEYED the producer picks the lane and
+ * nobody steals, so items pushed to one lane are taken one at a time in
+ * order by its single consumer.  with SCHEDULE_EDF items are kept in a
+ * heap under a mutex and the one pushed with the earliest deadline is
+ * taken first.  the policy must be set before any consumer runs.
+ *
+ * the lock-free queues grow on demand, set_limit() bounds the number of
+ * items held, push() then fails when full and push_wait() parks the
+ * producer on a second eventcount until a consumer takes an item.
+ */
+template <class T>
+class es_work_queue {
+    public:
+        es_work_queue(size_t capacity = 100) :
+            d_capacity(capacity),
+            d_queue(capacity),
+            d_next(0),
+            d_steal(false),
+            d_edf(false),
+            d_seq(0),
+            d_steals(0),
+            d_limit(0),
+            d_count(0),
+            d_waiters(0),
+            d_producers(0),
+            d_closed(false)
+        {
+        }
+
+        // select the policy, nlanes is the number of consumers
+        void set_policy(es_scheduling_policies policy, int nlanes){
+            d_lanes.clear();
+            d_steal = (policy == SCHEDULE_STEAL);
+            d_edf = (policy == SCHEDULE_EDF);
+            if(policy == SCHEDULE_STEAL || policy == SCHEDULE_KEYED){
+                for(int i=0; i<nlanes; i++)
+                    d_lanes.push_back( boost::shared_ptr< boost::lockfree::queue<T> >(new boost::lockfree::queue<T>(d_capacity)) );
+            }
+        }
+        int nlanes(){ return d_lanes.size(); }
+
+        // most items held at once, 0 for no limit
+        void set_limit(size_t limit){ d_limit = limit; }
+        size_t limit(){ return d_limit; }
+        size_t size(){ return d_count; }
+
+        /*
+         * fails only when the limit is reached, lane < 0 lets us choose,
+         * deadline only matters with SCHEDULE_EDF
+         */
+        bool push(const T &item, int lane = -1, uint64_t deadline = 0){
+            if(!put(item, lane, deadline))
+                return false;
+            wake_one();
+            return true;
+        }
+
+        /*
+         * push, parking while the queue is at its limit, returns false
+         * only if the queue is closed before room frees up
+         */
+        bool push_wait(const T &item, int lane = -1, uint64_t deadline = 0){
+            if(push(item, lane, deadline))
+                return true;
+
+            boost::mutex::scoped_lock lock(d_lock);
+            d_producers++;
+            while(true){
+                // d_lock is held, so wake a consumer directly
+                if(put(item, lane, deadline)){
+                    d_producers--;
+                    notify_consumers();
+                    return true;
+                }
+                if(d_closed){
+                    d_producers--;
+                    return false;
+                }
+                d_space_cond.wait(lock);
+            }
+        }
+
+        // non blocking, lane is the caller's own lane (if any)
+        bool pop(T &item, int lane = 0){
+            if(!take(item, lane))
+                return false;
+            d_count--;
+            if(d_producers > 0){
+                boost::mutex::scoped_lock lock(d_lock);
+                d_space_cond.notify_one();
+            }
+            return true;
+        }
+
+        /*
+         * wait for an item, returns false only once the queue has been
+         * closed and drained
+         */
+        bool wait_pop(T &item, int lane = 0){
+            return wait_pop_for(item, lane, 0);
+        }
+
+        /*
+         * as wait_pop() but gives up after timeout_ms milliseconds
+         * unless that is 0, check closed() to tell the two apart
+         */
+        bool wait_pop_for(T &item, int lane, int timeout_ms){
+            for(int i=0; i<SPIN_TRIES; i++){
+                if(pop(item, lane))
+                    return true;
+                boost::this_thread::yield();
+            }
+
+            boost::chrono::steady_clock::time_point deadline =
+                boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout_ms);
+            boost::mutex::scoped_lock lock(d_lock);
+            d_waiters++;
+            while(true){
+                // d_lock is held, so pop_locked() wakes a producer directly
+                if(pop_locked(item, lane)){
+                    d_waiters--;
+                    return true;
+                }
+                if(d_closed){
+                    d_waiters--;
+                    return false;
+                }
+                if(timeout_ms <= 0){
+                    d_cond.wait(lock);
+                } else if(d_cond.wait_until(lock, deadline) == boost::cv_status::timeout){
+                    bool got = pop_locked(item, lane);
+                    d_waiters--;
+                    return got;
+                }
+            }
+        }
+
+        // wake every consumer, wait_pop() then fails once the queue is empty
+        void close(){
+            boost::mutex::scoped_lock lock(d_lock);
+            d_closed = true;
+            d_cond.notify_all();
+            d_space_cond.notify_all();
+        }
+        void open(){ d_closed = false; }
+        bool closed(){ return d_closed; }
+
+        // consumers currently parked or about to park
+        int waiters(){ return d_waiters; }
+        // producers parked in push_wait()
+        int producers(){ return d_producers; }
+        // items taken from another consumer's lane
+        uint64_t steals(){ return d_steals; }
+
+    private:
+        static const int SPIN_TRIES = 64;
+
+        // ((deadline, push order), item), the heap top is the smallest
+        typedef std::pair< std::pair<uint64_t, uint64_t>, T > es_work_queue_entry;
+        static bool edf_compare(const es_work_queue_entry &a, const es_work_queue_entry &b){
+            return a.first > b.first;
+        }
+
+        // counted insert without any wakeup, fails at the limit
+        bool put(const T &item, int lane, uint64_t deadline){
+            size_t held = d_count++;
+            if(d_limit > 0 && held >= d_limit){
+                d_count--;
+                return false;
+            }
+            bool ok = true;
+            if(d_edf){
+                boost::mutex::scoped_lock lock(d_edf_lock);
+                d_edf_heap.push_back( es_work_queue_entry(std::make_pair(deadline, d_seq++), item) );
+                std::push_heap(d_edf_heap.begin(), d_edf_heap.end(), edf_compare);
+            } else if(d_lanes.empty()){
+                ok = d_queue.push(item);
+            } else {
+                ok = d_lanes[(lane < 0 ? d_next++ : lane) % d_lanes.size()]->push(item);
+            }
+            if(!ok){
+                d_count--;
+                return false;
+            }
+            return true;
+        }
+
+        // pop() for a caller already holding d_lock
+        bool pop_locked(T &item, int lane){
+            if(!take(item, lane))
+                return false;
+            d_count--;
+            if(d_producers > 0)
+                d_space_cond.notify_one();
+            return true;
+        }
+
+        bool take(T &item, int lane){
+            if(d_edf){
+                boost::mutex::scoped_lock lock(d_edf_lock);
+                if(d_edf_heap.empty())
+                    return false;
+                std::pop_heap(d_edf_heap.begin(), d_edf_heap.end(), edf_compare);
+                item = d_edf_heap.back().second;
+                d_edf_heap.pop_back();
+                return true;
+            }
+            if(d_lanes.empty())
+                return d_queue.pop(item);
+            int n = d_lanes.size();
+            lane = lane % n;
+            if(d_lanes[lane]->pop(item))
+                return true;
+            for(int i=1; d_steal && i<n; i++){
+                if(d_lanes[(lane + i) % n]->pop(item)){
+                    d_steals++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void wake_one(){
+            if(d_waiters > 0){
+                boost::mutex::scoped_lock lock(d_lock);
+                notify_consumers();
+            }
+        }
+
+        // the caller holds d_lock
+        void notify_consumers(){
+            // without stealing only the lane's own consumer can take it
+            if(d_edf || d_lanes.empty() || d_steal)
+                d_cond.notify_one();
+            else
+                d_cond.notify_all();
+        }
+
+        size_t d_capacity;
+        boost::lockfree::queue<T> d_queue;
+        std::vector< boost::shared_ptr< boost::lockfree::queue<T> > > d_lanes;
+        boost::atomic<unsigned int> d_next;
+        bool d_steal;
+        bool d_edf;
+        boost::mutex d_edf_lock;
+        std::vector<es_work_queue_entry> d_edf_heap;
+        uint64_t d_seq;     // under d_edf_lock
+        boost::atomic<uint64_t> d_steals;
+        boost::atomic<size_t> d_limit;
+        boost::atomic<size_t> d_count;
+        boost::mutex d_lock;
+        boost::condition_variable d_cond;         // consumers wait for items
+        boost::condition_variable d_space_cond;   // producers wait for room
+        boost::atomic<int> d_waiters;
+        boost::atomic<int> d_producers;
+        boost::atomic<bool> d_closed;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of gr-eventstream
+ *
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <es/es_affinity.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <vector>
+#include <boost/thread/once.hpp>
+
+#define DEBUG(X)
+//#define DEBUG(X)  X
+
+bool
+es_set_thread_affinity(const std::vector<int> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(size_t i=0; i<cpus.size(); i++){
+        if(cpus[i] < 0 || cpus[i] >= CPU_SETSIZE){
+            printf("WARNING: es_set_thread_affinity: no cpu %d\n", cpus[i]);
+            return false;
+        }
+        CPU_SET(cpus[i], &set);
+    }
+    if(CPU_COUNT(&set) == 0){
+        printf("WARNING: es_set_thread_affinity: no cpus given\n");
+        return false;
+    }
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(rc != 0){
+        printf("WARNING: es_set_thread_affinity: could not pin thread to cpus %s (%s)\n", es_cpu_list(cpus).c_str(), strerror(rc));
+        return false;
+    }
+    DEBUG(printf("es_set_thread_affinity: pinned to cpus %s\n", es_cpu_list(cpus).c_str());)
+    return true;
+}
+
+/*
+ * /sys/devices/system/cpu/cpuN holds a nodeM link for its node,
+ * read once for every cpu the first time a node is asked for
+ */
+static std::vector<int> cpu_nodes;
+static boost::once_flag cpu_nodes_once = BOOST_ONCE_INIT;
+
+static void
+read_cpu_nodes()
+{
+    cpu_nodes.assign(CPU_SETSIZE, -1);
+    for(int cpu=0; cpu<CPU_SETSIZE; cpu++){
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+        DIR* dir = opendir(path);
+        if(!dir)
+            continue;
+        struct dirent* ent;
+        while((ent = readdir(dir)) != NULL){
+            if(strncmp(ent->d_name, "node", 4) == 0 && ent->d_name[4] >= '0' && ent->d_name[4] <= '9'){
+                cpu_nodes[cpu] = atoi(ent->d_name + 4);
+                break;
+            }
+        }
+        closedir(dir);
+    }
+}
+
+int
+es_cpu_node(int cpu)
+{
+    if(cpu < 0 || cpu >= CPU_SETSIZE)
+        return -1;
+    boost::call_once(read_cpu_nodes, cpu_nodes_once);
+    return cpu_nodes[cpu];
+}
+
+std::vector<int>
+es_node_cpus(const std::vector<int> &cpus, int cpu)
+{
+    // with the node unknown every cpu of the list just as unknown goes
+    int node = es_cpu_node(cpu);
+    std::vector<int> set;
+    for(size_t i=0; i<cpus.size(); i++){
+        if(es_cpu_node(cpus[i]) == node)
+            set.push_back(cpus[i]);
+    }
+    return set;
+}
+
+std::string
+es_cpu_list(const std::vector<int> &cpus)
+{
+    std::ostringstream ss;
+    for(size_t i=0; i<cpus.size(); i++)
+        ss << (i ? "," : "") << cpus[i];
+    return ss.str();
+}
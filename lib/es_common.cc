@@ -28,6 +28,9 @@ using namespace pmt;
 #include <stdio.h>
 #include <gnuradio/basic_block.h>
 #include <boost/format.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/unordered_map.hpp>
 
 pmt_t es_make_arbiter(){
     
@@ -46,6 +49,7 @@ pmt_t es::event_type( pmt::intern("es::event_type") );
 pmt_t es::event_time( pmt::intern("es::event_time") );
 pmt_t es::event_length( pmt::intern("es::event_length") );
 pmt_t es::event_buffer( pmt::intern("es::event_buffer") );
+pmt_t es::event_deadline( pmt::intern("es::event_deadline") );
 
 // common es_event_type vals, can be expanded elsewhere in add on modules
 pmt_t es::event_type_1( pmt::intern("es::event_type_1") );
@@ -54,6 +58,34 @@ pmt_t es::event_type_gen_vector_c( pmt::intern("es::event_type_gen_vector_c") );
 pmt_t es::event_type_gen_vector_b( pmt::intern("es::event_type_gen_vector_b") );
 pmt_t es::event_type_gen_vector( pmt::intern("es::event_type_gen_vector") );
 
+// symbols are interned by pmt, so the symbol pointer identifies the type
+static boost::shared_mutex type_registry_lock;
+static boost::unordered_map<pmt_base*, int> type_registry_ids;
+static std::vector<pmt_t> type_registry_symbols;
+
+int es_event_type_id( pmt_t type ){
+    {
+        boost::shared_lock<boost::shared_mutex> lock(type_registry_lock);
+        boost::unordered_map<pmt_base*, int>::const_iterator it = type_registry_ids.find(type.get());
+        if(it != type_registry_ids.end())
+            return it->second;
+    }
+    boost::unique_lock<boost::shared_mutex> lock(type_registry_lock);
+    // another thread may have interned it while we were unlocked
+    std::pair<boost::unordered_map<pmt_base*, int>::iterator, bool> rv =
+        type_registry_ids.insert(std::make_pair(type.get(), (int)type_registry_symbols.size()));
+    if(rv.second)
+        type_registry_symbols.push_back(type);
+    return rv.first->second;
+}
+
+pmt_t es_event_type_symbol( int id ){
+    boost::shared_lock<boost::shared_mutex> lock(type_registry_lock);
+    if(id < 0 || id >= (int)type_registry_symbols.size())
+        return PMT_NIL;
+    return type_registry_symbols[id];
+}
+
 pmt_t event_create( std::string event_type, unsigned long long time, unsigned long long length ){
     return event_create( pmt::intern( event_type ), time, length );
 }
@@ -100,7 +132,7 @@ void event_print( pmt_t event ){
 
     pmt_t keys = pmt::dict_keys( msg_hash );
     printf(" * hash size = %d\n", (int)pmt::length(keys) );
-    for(int i=0; i<pmt::length(keys); i++){
+    for(size_t i=0; i<pmt::length(keys); i++){
         pmt_t key = pmt::nth(i, keys );
         pmt_t val = pmt::dict_ref( msg_hash, key, PMT_NIL );
         printf(" * %s  \t=> %s\n", pmt::symbol_to_string(key).c_str(), pmt::write_string(val).c_str());
@@ -172,7 +204,7 @@ pmt_t register_buffer( pmt_t event, gr_vector_void_star buf, gr_vector_int &sig
     pmt_t msg_hash = pmt::tuple_ref(event, 1);
     pmt_t buflist = pmt::PMT_NIL;
 
-    for(int i=0; i<buf.size(); i++){
+    for(size_t i=0; i<buf.size(); i++){
         buflist = pmt::list_add(buflist, pmt::init_u8vector( sig[0], (const uint8_t*) buf[i]) );
     }
 
@@ -195,7 +227,7 @@ gr::io_signature::sptr es_make_io_signature( int min, const std::vector<int> &si
 
 std::vector<unsigned char> string_to_vector(std::string s){
     std::vector<unsigned char> vec(s.size());
-    for(int i=0; i<s.size(); i++){
+    for(size_t i=0; i<s.size(); i++){
         vec[i] = s[i];
     }
     return vec;
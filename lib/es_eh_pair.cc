@@ -23,11 +23,15 @@
 #include <es/es_eh_pair.hh>
 #include <es/es_common.h>
 #include <es/es_handler.h>
+#include <es/es_eh_pair_pool.hh>
 #include <stdio.h>
 
-es_eh_pair::es_eh_pair(pmt_t _event, pmt_t _handler) :
-    handler(_handler), 
-    event(_event)
+es_eh_pair::es_eh_pair(const es_event &_event, es_handler* _handler) :
+    event(_event),
+    handler(_handler),
+    stream(NULL),
+    charge(NULL),
+    pinned(true)
     {
 
 }
@@ -35,18 +39,50 @@ es_eh_pair::es_eh_pair(pmt_t _event, pmt_t _handler) :
 void es_eh_pair::run(){
 
     // new style handler call
-    es_handler* h = boost::any_cast< es_handler* >(pmt::any_ref(handler));
-    h->handler_helper( event );
+    handler->handler_helper( event );
 
 }
 
 
-unsigned long long es_eh_pair::time(){
-    return event_time( event );
+/*
+ * every pair is preceded by a header naming the pool it came from
+ * (NULL for the heap), padded so the pair itself stays aligned
+ */
+union es_eh_pair_header {
+    es_eh_pair_pool* pool;
+    long double align;
+};
+
+size_t es_eh_pair::slot_size(){
+    return sizeof(es_eh_pair_header) + sizeof(es_eh_pair);
+}
+
+void* es_eh_pair::operator new(size_t sz){
+    es_eh_pair_header* hdr = (es_eh_pair_header*) ::operator new(sizeof(es_eh_pair_header) + sz);
+    hdr->pool = NULL;
+    return hdr + 1;
+}
+
+void* es_eh_pair::operator new(size_t sz, es_eh_pair_pool &pool){
+    es_eh_pair_header* hdr = (es_eh_pair_header*) pool.acquire(sizeof(es_eh_pair_header) + sz);
+    hdr->pool = &pool;
+    return hdr + 1;
+}
+
+void es_eh_pair::operator delete(void* ptr){
+    if(ptr == NULL)
+        return;
+    es_eh_pair_header* hdr = ((es_eh_pair_header*) ptr) - 1;
+    if(hdr->pool){
+        hdr->pool->release(hdr);
+    } else {
+        ::operator delete(hdr);
+    }
 }
 
-unsigned long long es_eh_pair::length(){
-    return event_length( event );
+// only used if the constructor throws after a pooled new
+void es_eh_pair::operator delete(void* ptr, es_eh_pair_pool &pool){
+    pool.release(((es_eh_pair_header*) ptr) - 1);
 }
 
 es_eh_pair::~es_eh_pair(){
@@ -0,0 +1,82 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ * 
+ * This file is part of gr-eventstream
+ * 
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <es/es_eh_pair_pool.hh>
+#include <es/es_eh_pair.hh>
+#include <algorithm>
+#include <stdexcept>
+
+#define DEBUG(X)
+//#define DEBUG(X)  X
+
+es_eh_pair_pool::es_eh_pair_pool(size_t slab_size) :
+    d_slab_size(slab_size),
+    d_free(slab_size),
+    d_hits(0), d_misses(0), d_capacity(0),
+    d_outstanding(0), d_peak(0)
+{
+}
+
+es_eh_pair_pool::~es_eh_pair_pool(){
+    for(size_t i=0; i<d_slabs.size(); i++){
+        delete [] d_slabs[i];
+    }
+}
+
+// carve a new slab of n slots and put them all on the free list
+void es_eh_pair_pool::grow(size_t n){
+    size_t slot = es_eh_pair::slot_size();
+    char* slab = new char[n*slot];
+    DEBUG(printf("es_eh_pair_pool::grow() adding %lu slots\n", n);)
+    boost::mutex::scoped_lock lock(d_slab_lock);
+    d_slabs.push_back(slab);
+    for(size_t i=0; i<n; i++){
+        d_free.push(slab + i*slot);
+    }
+    d_capacity += n;
+}
+
+void* es_eh_pair_pool::acquire(size_t sz){
+    if(sz > es_eh_pair::slot_size())
+        throw std::runtime_error("es_eh_pair_pool: object larger than pool slot");
+
+    void* slot = NULL;
+    if(d_free.pop(slot)){
+        d_hits++;
+    } else {
+        // double the pool, the size follows the peak number of live pairs
+        d_misses++;
+        do {
+            grow(std::max((size_t)d_capacity, d_slab_size));
+        } while(!d_free.pop(slot));
+    }
+
+    uint64_t live = ++d_outstanding;
+    if(live > d_peak)
+        d_peak = live;
+    return slot;
+}
+
+void es_eh_pair_pool::release(void* slot){
+    d_outstanding--;
+    d_free.push(slot);
+}
@@ -21,42 +21,109 @@
  */
 
 #include <es/es_event.h>
+#include <es/es_common.h>
 #include <limits.h>
 #include <stdio.h>
 
-es_event_sptr es_make_event(pmt_t arb){
-    return es_event_sptr(new es_event(arb));
+es_event::es_event() :
+    d_type(PMT_NIL),
+    d_type_id(-1),
+    d_time(ULLONG_MAX),
+    d_length(0),
+    d_buffer(PMT_NIL),
+    d_buffer_owner(PMT_NIL),
+    d_args(pmt::make_dict()),
+    d_merge(PMT_NIL),
+    d_pmt(PMT_NIL)
+{
 }
 
-es_event::es_event(pmt_t arb){
-    args = pmt::make_dict();
-    d_time = ULLONG_MAX;
-    d_max_length = 0;
-    d_name = "EVENT_BASE";
+es_event::es_event(pmt_t type, uint64_t time, uint64_t length) :
+    d_type(type),
+    d_type_id(es_event_type_id(type)),
+    d_time(time),
+    d_length(length),
+    d_buffer(PMT_NIL),
+    d_buffer_owner(PMT_NIL),
+    d_args(pmt::make_dict()),
+    d_merge(PMT_NIL),
+    d_pmt(PMT_NIL)
+{
 }
 
-void es_event::set_time(unsigned long long time){
+/*
+ * The dict of a parsed event is kept whole as the args, the core fields
+ * are re-added over it by to_pmt() so they always win.  Until the event
+ * is modified the original pmt is handed back unchanged.
+ */
+es_event::es_event(pmt_t evt) :
+    d_buffer_owner(PMT_NIL),
+    d_merge(PMT_NIL),
+    d_pmt(evt)
+{
+    if(!is_event(evt))
+        throw std::runtime_error("es_event: can not parse a pmt which is not an event");
+    d_args = pmt::tuple_ref(evt, 1);
+    d_type = pmt::dict_ref(d_args, es::event_type, PMT_NIL);
+    d_type_id = es_event_type_id(d_type);
+    d_time = pmt::to_uint64(pmt::dict_ref(d_args, es::event_time, pmt::from_uint64(ULLONG_MAX)));
+    d_length = pmt::to_uint64(pmt::dict_ref(d_args, es::event_length, pmt::from_uint64(0)));
+    d_buffer = pmt::dict_ref(d_args, es::event_buffer, PMT_NIL);
+}
+
+void es_event::set_time(uint64_t time){
     d_time = time;
+    d_pmt = PMT_NIL;
 }
 
-void es_event::print(){
-    printf("EVENT(d_time=%llu, d_name=%s)\n", d_time, d_name.c_str());
-    printf(" * ARGS :: \n");
+void es_event::set_buffer(pmt_t buf_list){
+    set_buffer(buf_list, PMT_NIL);
+}
+
+void es_event::set_buffer(pmt_t buf_list, pmt_t owner){
+    d_buffer = buf_list;
+    d_buffer_owner = owner;
+    d_pmt = PMT_NIL;
+}
 
-//    std::string out = pmt_write_string(args);
-//    printf("RAW = %s\n", out.c_str());
+void es_event::add_arg(pmt_t key, pmt_t val){
+    d_args = pmt::dict_add(d_args, key, val);
+    d_pmt = PMT_NIL;
+}
 
-    pmt_t keys = pmt::dict_keys(args);
-    for(int i=0; i<pmt::length(keys); i++){
-        //printf("   * i = %d\n", i);
-        pmt_t key = pmt::nth(i, keys);
-        pmt_t val = pmt::dict_ref(args, key, key);
-        printf("   * %s = %s\n", pmt::symbol_to_string(key).c_str(), pmt::write_string(val).c_str() );
-    }
+bool es_event::has_arg(pmt_t key) const {
+    return pmt::dict_has_key(d_args, key) ||
+        (!pmt::eq(d_merge, PMT_NIL) && pmt::dict_has_key(d_merge, key));
+}
 
+pmt_t es_event::arg(pmt_t key) const {
+    if(!pmt::eq(d_merge, PMT_NIL) && pmt::dict_has_key(d_merge, key))
+        return pmt::dict_ref(d_merge, key, PMT_NIL);
+    return pmt::dict_ref(d_args, key, PMT_NIL);
 }
 
+void es_event::merge_args(pmt_t dict){
+    d_merge = dict;
+    d_pmt = PMT_NIL;
+}
 
+pmt_t es_event::to_pmt(){
+    if(!pmt::eq(d_pmt, PMT_NIL))
+        return d_pmt;
 
+    pmt_t hash = d_args;
+    if(!pmt::eq(d_merge, PMT_NIL))
+        hash = pmt::dict_update(hash, d_merge);
+    hash = pmt::dict_add( hash, es::event_type, d_type );
+    hash = pmt::dict_add( hash, es::event_time, pmt::from_uint64(d_time) );
+    hash = pmt::dict_add( hash, es::event_length, pmt::from_uint64(d_length) );
+    if(!pmt::eq(d_buffer, PMT_NIL))
+        hash = pmt::dict_add( hash, es::event_buffer, d_buffer );
 
+    d_pmt = pmt::make_tuple( es::type_es_event, hash );
+    return d_pmt;
+}
 
+void es_event::print(){
+    event_print( to_pmt() );
+}
@@ -40,21 +40,21 @@ void es_event_acceptor::schedule_event(pmt::pmt_t m){
                         return;
                     }
 
-                    // create the event
-                    pmt::pmt_t evt = event_create( etype, time, len );
+                    // create the event, it stays native until a handler needs the pmt form
+                    es_event evt( etype, time, len );
 
                     //register buffer if we have one
                     if(buf_list.get())
-                        evt = event_args_add(evt, pmt::mp("vector"), buf_list);
+                        evt.add_arg(pmt::mp("vector"), buf_list);
 
                     // copy any other keys in by default
                     pmt::pmt_t keys = pmt::dict_keys(pmt::car(m));
-                    while(pmt::is_pair(keys)){
+                    for(; pmt::is_pair(keys); keys = pmt::cdr(keys)){
+                        pmt::pmt_t key = pmt::car(keys);
                         // skip known keys
-                        if(pmt::eqv(keys,pmt::mp("event_time")) || pmt::eqv(keys,pmt::mp("event_length")) || pmt::eqv(keys,pmt::mp("event_type")))
+                        if(pmt::eqv(key,pmt::mp("event_time")) || pmt::eqv(key,pmt::mp("event_length")) || pmt::eqv(key,pmt::mp("event_type")))
                             continue;
-                        evt = event_args_add(evt, pmt::car(keys), pmt::dict_ref(pmt::car(m),pmt::car(keys),pmt::PMT_NIL));
-                        keys = pmt::cdr(keys);
+                        evt.add_arg(key, pmt::dict_ref(pmt::car(m),key,pmt::PMT_NIL));
                         }
 
                     // add to the queue
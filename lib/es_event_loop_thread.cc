@@ -23,19 +23,25 @@
 #include <stdio.h>
 #include <es/es_common.h>
 #include <es/es_event_loop_thread.hh>
+#include <es/es_affinity.h>
 
 /*
  * Constructor function, sets up parameters
  */
-es_event_loop_thread::es_event_loop_thread(pmt_t _arb, es_queue_sptr _queue, boost::lockfree::queue<es_eh_pair*> *_qq, boost::lockfree::queue<unsigned long long> *_dq, boost::condition *_qq_cond, boost::atomic<int> *nevents, boost::atomic<uint64_t> *num_running_handlers) :
+es_event_loop_thread::es_event_loop_thread(pmt_t _arb, es_queue_sptr _queue, es_work_queue<es_eh_pair*> *_qq, boost::lockfree::queue<es_eh_done> *_dq, es_event_counter *nevents, boost::atomic<uint64_t> *num_running_handlers, int lane, es_pool_size *pool, std::vector<int> cpus) :
+    d_nevents(nevents),
+    d_num_running_handlers(num_running_handlers),
     arb(_arb),
     queue(_queue),
+    finished(false),
     qq(_qq),
     dq(_dq),
-    qq_cond(_qq_cond),
-    finished(false),
-    d_nevents(nevents),
-    d_num_running_handlers(num_running_handlers)
+    d_lane(lane),
+    d_pool(pool),
+    d_exited(false),
+    d_cpus(cpus),
+    d_node(cpus.empty() ? -1 : es_cpu_node(cpus[0])),
+    d_pinned(!cpus.empty())
 {
     start();
 }
@@ -49,12 +55,12 @@ void es_event_loop_thread::start(){
 
 /*
  * Shut down all the running threads and join them.
- *   Called by es_sink destructor
+ *   Called by es_sink destructor, closing the shared work queue
+ *   lets every thread finish what is queued and return
  */
 void es_event_loop_thread::stop(){
     finished = true;
-    qq_cond->notify_all();
-    d_thread->interrupt();
+    qq->close();
     d_thread->join();
 }
 
@@ -66,36 +72,43 @@ void es_event_loop_thread::stop(){
  */
 void es_event_loop_thread::do_work(){
 
-//    // used by boost::condition, has no scope outside of this thread, unneccisary
-    boost::mutex access;
-    boost::mutex::scoped_lock lock(access);
-
-    // run the thread until we are told to shut down
-    while(!finished){
-        es_eh_pair* eh = NULL;
+    es_eh_pair* eh = NULL;
 
-        // wait for a signal to start looking in the queue
-        qq_cond->wait(lock);
-        (*d_num_running_handlers)++;
+    // pin before the first event so everything we allocate is node local
+    if(d_pinned && !es_set_thread_affinity(d_cpus))
+        d_pinned = false;
 
-        // get events to handle as long as they are available
-        while( (*qq).pop(eh) ){
+    // run the thread until the work queue is closed and drained,
+    // wait_pop() parks us whenever there is nothing to do, in an
+    // autoscaled pool we give up our place after idling long enough
+    int idle_ms = d_pool ? d_pool->idle_ms : 0;
+    while(true){
+        if( qq->wait_pop_for(eh, d_lane, idle_ms) ){
+            run_pair(eh, dq, d_nevents, d_num_running_handlers);
+        } else if( qq->closed() || (d_pool && d_pool->try_retire()) ){
+            break;
+        }
+    }
+    d_exited = true;
+}
 
-            //printf("dequeue returned.\n");
+void es_event_loop_thread::run_pair(es_eh_pair* eh,
+    boost::lockfree::queue<es_eh_done> *dq,
+    es_event_counter *nevents,
+    boost::atomic<uint64_t> *num_running_handlers)
+{
+    (*num_running_handlers)++;
 
-            // run the event/handler pair
-            eh->run();
+    // run the event/handler pair
+    eh->run();
 
-            // enqueue the time marker for deletion
-            (*dq).push( eh->time() );
+    // enqueue the completion for the sink to retire
+    (*dq).push( eh->done() );
 
-            // decrement number of events
-            int a = *d_nevents;
-            (*d_nevents)--;
+    // decrement number of events
+    (*nevents)--;
 
-            // delete the reference
-            delete eh;
-        }
-        (*d_num_running_handlers)--;
-    }
+    // delete the reference
+    delete eh;
+    (*num_running_handlers)--;
 }
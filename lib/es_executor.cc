@@ -0,0 +1,169 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of gr-eventstream
+ *
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <es/es_executor.h>
+
+#include <stdio.h>
+#include <algorithm>
+#include <stdexcept>
+
+#define DEBUG(X)
+//#define DEBUG(X)  X
+
+es_executor_sptr
+es_make_executor(int n_threads)
+{
+    return es_executor_sptr(new es_executor(n_threads));
+}
+
+es_executor::es_executor(int n_threads) :
+    d_clients_version(0),
+    d_cursor(0),
+    d_epoch(0),
+    d_waiters(0),
+    d_num_run(0),
+    d_finished(false)
+{
+    if(n_threads < 1)
+        throw std::runtime_error("es_executor: need at least one thread");
+    for(int i=0; i<n_threads; i++){
+        d_threads.push_back( boost::shared_ptr<boost::thread>(
+            new boost::thread(boost::bind(&es_executor::do_work, this))) );
+    }
+}
+
+es_executor::~es_executor()
+{
+    {
+        boost::mutex::scoped_lock lock(d_lock);
+        d_finished = true;
+        d_cond.notify_all();
+    }
+    for(size_t i=0; i<d_threads.size(); i++){
+        d_threads[i]->join();
+    }
+}
+
+void
+es_executor::attach(es_executor_client* client, int weight)
+{
+    es_executor_entry_sptr e(new es_executor_entry());
+    e->client = client;
+    e->weight = std::max(weight, 1);
+    e->detached = false;
+
+    boost::unique_lock<boost::shared_mutex> lock(d_clients_lock);
+    d_clients.push_back(e);
+    d_clients_version++;
+    DEBUG(printf("es_executor::attach %p weight %d\n", client, e->weight);)
+}
+
+void
+es_executor::detach(es_executor_client* client)
+{
+    es_executor_entry_sptr e;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(d_clients_lock);
+        for(size_t i=0; i<d_clients.size(); i++){
+            if(d_clients[i]->client == client){
+                e = d_clients[i];
+                d_clients.erase(d_clients.begin() + i);
+                d_clients_version++;
+                break;
+            }
+        }
+    }
+    if(!e)
+        return;
+
+    // workers still on an older copy of the list skip the client from
+    // here on, wait out any already inside its run_one()
+    e->detached = true;
+    e->inflight.wait_zero();
+}
+
+void
+es_executor::notify()
+{
+    d_epoch++;
+    if(d_waiters > 0){
+        boost::mutex::scoped_lock lock(d_lock);
+        d_cond.notify_one();
+    }
+}
+
+/*
+ * one weighted pass over the clients, starting one further along each
+ * time so no client is always served first
+ */
+int
+es_executor::run_round(std::vector<es_executor_entry_sptr> &clients, unsigned int &version)
+{
+    if(version != d_clients_version){
+        boost::shared_lock<boost::shared_mutex> lock(d_clients_lock);
+        clients = d_clients;
+        version = d_clients_version;
+    }
+
+    int ran = 0;
+    int n = clients.size();
+    if(n == 0)
+        return 0;
+    int start = d_cursor++ % n;
+    for(int k=0; k<n; k++){
+        es_executor_entry &e = *clients[(start + k) % n];
+        // counted before the detached check, detach() sets it before
+        // waiting, so one of us always sees the other
+        e.inflight++;
+        for(int w=0; !e.detached && w<e.weight; w++){
+            if(!e.client->run_one())
+                break;
+            d_num_run++;
+            ran++;
+        }
+        e.inflight--;
+    }
+    return ran;
+}
+
+void
+es_executor::do_work()
+{
+    std::vector<es_executor_entry_sptr> clients;
+    unsigned int version = 0;
+    while(true){
+        unsigned int epoch = d_epoch;
+        if(run_round(clients, version) > 0)
+            continue;
+
+        // nothing queued anywhere, park until a block notifies, a push
+        // made since our pass started has already moved the epoch
+        boost::mutex::scoped_lock lock(d_lock);
+        d_waiters++;
+        while(!d_finished && d_epoch == epoch){
+            d_cond.wait(lock);
+        }
+        d_waiters--;
+        if(d_finished)
+            return;
+    }
+}
@@ -47,6 +47,11 @@ void es_handler::handler_helper( pmt_t msg ){
     handler( msg, get_buffer_ptr(buf_arg) );
 }
 
+// native event path, the buffer list is read without a dict lookup
+void es_handler::handler_helper( es_event &evt ){
+    handler( evt.to_pmt(), get_buffer_ptr(evt.buffer()) );
+}
+
 es_handler::~es_handler(){
 //    printf("Handler Base Class destructing (%x)!\n",this);
 }
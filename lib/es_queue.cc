@@ -24,6 +24,7 @@
 #include <es/es_common.h>
 #include <es/es_exceptions.h>
 #include <algorithm>
+#include <assert.h>
 
 #include <limits.h>
 #include <stdio.h>
@@ -36,11 +37,28 @@ es_queue_sptr es_make_queue(es_queue_early_behaviors eb, es_search_behaviors sb)
 }
 
 es_queue::es_queue(es_queue_early_behaviors eb, es_search_behaviors sb) :
-    d_early_behavior(eb), d_num_discarded(0), d_num_asap(0),
+    d_early_behavior(eb), d_num_asap(0), d_num_discarded(0),
     d_num_events_added(0), d_num_events_removed(0), d_event_time(0),
-    d_num_soon(0), d_search_behavior(sb)
+    d_num_soon(0), d_staged(128), d_num_staged(0), d_handler_counts(NULL),
+    d_search_behavior(sb)
 {
-    bindings = pmt::make_dict();
+}
+
+/*
+ * pairs still queued or staged are destroyed before the pool their
+ * storage comes from goes away, so their events' pmt references are freed
+ */
+es_queue::~es_queue(){
+    es_eh_pair* staged = NULL;
+    while(d_staged.pop(staged)){
+        delete staged;
+    }
+    for(size_t i=0; i<event_queue.size(); i++){
+        delete event_queue[i];
+    }
+    for(size_t i=0; i<d_soon.size(); i++){
+        delete d_soon[i];
+    }
 }
 
 void es_queue::set_early_behavior(enum es_queue_early_behaviors v){
@@ -49,11 +67,36 @@ void es_queue::set_early_behavior(enum es_queue_early_behaviors v){
 
 int es_queue::length(){
     queue_lock.lock();
-    int l = event_queue.size();
+    int l = event_queue.size() + d_soon.size() + d_num_staged;
     queue_lock.unlock();
     return l;
 }
 
+bool es_queue::empty(){
+    boost::mutex::scoped_lock lock(queue_lock);
+    return event_queue.empty() && d_soon.empty() && d_num_staged == 0;
+}
+
+uint64_t es_queue::min_time(){
+    boost::mutex::scoped_lock lock(queue_lock);
+    merge_staged();
+    return earliest_time();
+}
+
+/**
+ * @brief Time of the earliest queued event, 0 if there is none.
+ *
+ * The caller must hold queue_lock.
+ */
+uint64_t es_queue::earliest_time()
+{
+    if(d_soon.empty())
+        return event_queue.empty() ? 0 : event_queue[0]->time();
+    if(event_queue.empty())
+        return d_soon[0]->time();
+    return std::min(event_queue[0]->time(), d_soon[0]->time());
+}
+
 /**
  * @brief Search forward through event_queue to find an insertion index.
  *
@@ -108,7 +151,7 @@ es_queue::find_reverse(const uint64_t evt_time)
  * @param [in] cval Reference to an item to be inserted into the
  *   event_queue vector (comparison value).
  */
-bool queue_compare(es_eh_pair* vval, const int64_t& cval)
+static bool queue_compare(es_eh_pair* vval, const uint64_t& cval)
 {
   return cval > vval->time();
 };
@@ -160,55 +203,227 @@ int es_queue::find_index(uint64_t evt_time)
     }
 }
 
-int es_queue::add_event(pmt_t evt){
+/**
+ * @brief Comparison function used to keep event_queue as a binary min-heap
+ *   when SEARCH_HEAP is selected (std heap algorithms build a max-heap).
+ */
+static bool heap_compare(es_eh_pair* a, es_eh_pair* b)
+{
+  return a->time() > b->time();
+}
 
-//    printf("WARNING: currently events must be added to the queue after binding it to a source block to avoid issues ... the add callback must be first defined\n");
-//    DEBUG(printf("es_queue::add_event...\n");)
+static bool time_compare(es_eh_pair* a, es_eh_pair* b)
+{
+  return a->time() < b->time();
+}
 
-    std::map< std::string, std::vector<pmt_t> >::iterator it;
+/**
+ * @brief Insert an eh pair into event_queue using the configured backend.
+ *
+ * SEARCH_HEAP pushes onto a binary heap in O(log n), all other behaviors
+ * insert into the sorted vector at the index found by find_index().
+ * The caller must hold queue_lock.
+ */
+void es_queue::queue_insert(es_eh_pair* eh)
+{
+    if(d_search_behavior == SEARCH_HEAP){
+        event_queue.push_back(eh);
+        std::push_heap(event_queue.begin(), event_queue.end(), heap_compare);
+    } else {
+        event_queue.insert(event_queue.begin() + find_index(eh->time()), eh);
+    }
+}
 
-//    printf("add_event of type :: %s\n", event_type(evt).c_str() );
+/**
+ * @brief Remove the earliest eh pair (event_queue[0]) from event_queue.
+ *
+ * The caller must hold queue_lock.
+ */
+void es_queue::queue_pop_front()
+{
+    if(d_search_behavior == SEARCH_HEAP){
+        std::pop_heap(event_queue.begin(), event_queue.end(), heap_compare);
+        event_queue.pop_back();
+    } else {
+        event_queue.erase(event_queue.begin());
+    }
+}
 
-    bool found = pmt::dict_has_key(bindings, pmt::intern(event_type(evt)));
-    if(!found){
-        printf("WARNING: attempted to add event to queue of type which we are unaware! Discarding\n");
-        event_print(evt);
-        return -1;
+/**
+ * @brief Remove and return the earliest eh pair which can be serviced
+ *   before max.
+ *
+ * Events are visited in time order, every event skipped because it is not
+ * yet complete in the buffer is counted in d_num_soon.  For the heap
+ * backend skipped events are popped aside and pushed back afterwards.
+ * The caller must hold queue_lock.
+ *
+ * @param [in] max Upper bound of the sample times currently available.
+ * @param [in] whole_event If true the whole event must end before max,
+ *   otherwise only the event start must be before max.
+ *
+ * @return The removed eh pair, or NULL if no event fits.
+ */
+es_eh_pair* es_queue::queue_take_first(unsigned long long max, bool whole_event)
+{
+    es_eh_pair* found = NULL;
+
+    if(d_search_behavior != SEARCH_HEAP){
+        // stop at the window edge like the heap does so both backends
+        // count the same events in d_num_soon
+        for(size_t i=0; i<event_queue.size() && event_queue[i]->time() < max; i++){
+            es_eh_pair* eh_test = event_queue[i];
+            if(eh_test->time() + (whole_event?eh_test->length():0) < max){
+                event_queue.erase(event_queue.begin()+i);
+                return eh_test;
+            }
+            d_num_soon++;
         }
+        return NULL;
+    }
 
-    pmt_t keys = pmt::dict_keys(bindings);
-    while(pmt::is_pair(keys)){
-//        printf("entry: %s\n", pmt_symbol_to_string(pmt_car(keys)).c_str() );
-//        int a = pmt_eqv( pmt_car(keys), event_type_pmt(evt) );
-//        printf("pmt_eqv = %d\n", a);
-        keys = pmt::cdr(keys);
+    std::vector<es_eh_pair*> skipped;
+    while(!event_queue.empty()){
+        es_eh_pair* eh_test = event_queue[0];
+        // nothing later in the heap can start before max either
+        if(eh_test->time() >= max)
+            break;
+        queue_pop_front();
+        if(eh_test->time() + (whole_event?eh_test->length():0) < max){
+            found = eh_test;
+            break;
         }
+        d_num_soon++;
+        skipped.push_back(eh_test);
+    }
+    for(size_t i=0; i<skipped.size(); i++){
+        queue_insert(skipped[i]);
+    }
+    return found;
+}
 
-    pmt_t handlers = pmt::dict_ref(bindings, event_type_pmt(evt), PMT_NIL);
-//    printf("handlers.size() = %d\n", (int)pmt_length(handlers));
+/**
+ * @brief Put the heap backend's pending events (d_soon) back in the heap.
+ *
+ * Only fetch_ready_events() keeps events aside, every other accessor of
+ * the heap calls this first.  The caller must hold queue_lock.
+ */
+void es_queue::flush_soon()
+{
+    for(size_t i=0; i<d_soon.size(); i++){
+        queue_insert(d_soon[i]);
+    }
+    d_soon.clear();
+}
+
+/**
+ * @brief Move the earliest eh pair to a new (later) time.
+ *
+ * Used for ASAP scheduling, the pair is re-inserted so the sorted vector
+ * and heap orderings both stay valid.  The caller must hold queue_lock.
+ */
+void es_queue::queue_reschedule_front(uint64_t time)
+{
+    es_eh_pair* eh = event_queue[0];
+    queue_pop_front();
+    eh->set_time(time);
+    queue_insert(eh);
+}
+
+/**
+ * @brief Move every eh pair staged by add_event() into event_queue.
+ *
+ * Events staged without a handler are bound here, one pair per handler
+ * of their type, so only the consumer reads the bindings.  Staged pairs
+ * are sorted as a batch and merged into the sorted vector in one pass
+ * rather than searched for one at a time, the heap backend just pushes
+ * each one.  The caller must hold queue_lock.
+ */
+void es_queue::merge_staged()
+{
+    if(d_num_staged == 0)
+        return;
+
+    size_t nold = event_queue.size();
+    std::vector<es_eh_pair*> bound;
+    es_eh_pair* staged = NULL;
+    boost::shared_lock<boost::shared_mutex> lock(d_bindings_lock);
+    while(d_staged.pop(staged)){
+        d_num_staged--;
+        bound.clear();
+        if(staged->handler != NULL){
+            // already bound and offered to the append callbacks
+            bound.push_back(staged);
+        } else {
+            bind_pairs(staged, bound);
+        }
+        for(size_t i=0; i<bound.size(); i++){
+            d_num_events_added++;
+            if(d_search_behavior == SEARCH_HEAP){
+                queue_insert(bound[i]);
+            } else {
+                event_queue.push_back(bound[i]);
+            }
+        }
+    }
+    if(d_search_behavior != SEARCH_HEAP && event_queue.size() != nold){
+        std::stable_sort(event_queue.begin()+nold, event_queue.end(), time_compare);
+        std::inplace_merge(event_queue.begin(), event_queue.begin()+nold, event_queue.end(), time_compare);
+    }
+}
+
+int es_queue::add_event(pmt_t evt){
+    // parse the pmt form once, everything past here uses the native event
+    return add_event( es_event(evt) );
+}
+
+int es_queue::add_event(const es_event &evt){
+
+//    printf("WARNING: currently events must be added to the queue after binding it to a source block to avoid issues ... the add callback must be first defined\n");
+//    DEBUG(printf("es_queue::add_event...\n");)
+
+    // checked against the published handler counts, so producers take
+    // neither queue_lock nor d_bindings_lock
+    int type_id = evt.type_id();
+    const std::vector<int>* counts = d_handler_counts.load(boost::memory_order_acquire);
+    int nhandlers = (counts && type_id >= 0 && (size_t)type_id < counts->size()) ? (*counts)[type_id] : -1;
+    if(nhandlers < 0){
+        printf("WARNING: attempted to add event to queue of type which we are unaware! Discarding\n");
+        es_event(evt).print();
+        return -1;
+        }
 
     // TODO: We may not really want to check this at runtime ...
-    if(pmt::length(handlers) == 0){
+    if(nhandlers == 0){
         printf("WARNING: attempted to add event to queue for which no handler is defined!\n");
+        return 0;
         }
 
-    if(event_time(evt) == ULLONG_MAX){
-        fprintf(stderr, "WARNING: event recieved with unset time. (%s)\n", event_type(evt).c_str());
+    if(evt.time() == ULLONG_MAX){
+        fprintf(stderr, "WARNING: event recieved with unset time. (%s)\n", pmt::symbol_to_string(evt.type()).c_str());
     }
 
-    queue_lock.lock();
-
-    int idx = find_index(event_time(evt));
+    // the event is staged unbound and merge_staged() pairs it with its handlers
+    if(cb_list.empty()){
+        es_eh_pair* staged = new (d_pair_pool) es_eh_pair( evt, NULL );
+        d_num_staged++;
+        d_staged.push(staged);
+        return 0;
+    }
 
-    //for(int i=0; i<handlers.size(); i++){
+    // the append callbacks must see every pair as it is added, so bind
+    // here instead, the bindings are only read
+    std::vector<es_eh_pair*> pairs;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(d_bindings_lock);
+        bind_pairs(new (d_pair_pool) es_eh_pair( evt, NULL ), pairs);
+    }
 
-    while(pmt::is_pair(handlers)){
-        es_eh_pair* eh_pair = new es_eh_pair( evt, pmt::car(handlers) );
+    for(size_t h=0; h<pairs.size(); h++){
+        es_eh_pair* eh_pair = pairs[h];
 
         DEBUG(printf("created new eh_pair = %x\n", eh_pair);)
-        DEBUG(printf("evt = %s\n",  pmt::write_string(evt).c_str());)
-        DEBUG(printf("handler = %s\n", pmt::write_string(pmt::car(handlers)).c_str());)
-        DEBUG(printf("is any = %d, is ma = %d\n", pmt::is_any(pmt::car(handlers)), pmt::is_msg_accepter(pmt::car(handlers)));)
+        DEBUG(printf("handler = %p\n", eh_pair->handler);)
 
         // by default we add to queue
         bool append_pair = true;
@@ -219,23 +434,64 @@ int es_queue::add_event(pmt_t evt){
 
         // call any callbacks bound with each new eh pair
         // if any return false, suppress addition to queue
-        for(int i=0; i < cb_list.size(); i++ ){
+        for(size_t i=0; i < cb_list.size(); i++ ){
             bool rv = cb_list[i](&eh_pair);
-            append_pair = append_pair | rv;
+            append_pair = append_pair && rv;
         }
 
-        // conditionally add the eh pair to the queue
+        // conditionally stage the eh pair for the consumer to merge,
+        // counted first so length() never under reports
         if(append_pair){
-            event_queue.insert(event_queue.begin()+idx, eh_pair);
-            d_num_events_added++;
+            d_num_staged++;
+            d_staged.push(eh_pair);
         }
 
-        // iterate to next handler
-        handlers = pmt::cdr(handlers);
+    }
+    return 0;
+}
 
+/*
+ * bind an unbound staged pair to every handler of its event type, the
+ * staged pair is reused for the first handler.  add_event() already
+ * warned about and dropped events without a handler, and bindings are
+ * never removed, so every staged event has one.
+ * the caller must hold d_bindings_lock
+ */
+void es_queue::bind_pairs(es_eh_pair* staged, std::vector<es_eh_pair*> &out){
+    int type_id = staged->event.type_id();
+    assert(type_registered(type_id) && !d_bindings[type_id].empty());
+
+    const std::vector<es_handler*> &handlers = d_bindings[type_id];
+    const std::vector<es_stream_handler*> &streams = d_stream_bindings[type_id];
+
+    for(size_t h=0; h<handlers.size(); h++){
+        es_eh_pair* eh_pair = (h == 0) ? staged : new (d_pair_pool) es_eh_pair( staged->event, NULL );
+        eh_pair->handler = handlers[h];
+        eh_pair->stream = streams[h];
+        out.push_back(eh_pair);
     }
-    queue_lock.unlock();
+}
 
+/*
+ * true if the interned event type id has been registered with this queue,
+ * the caller must hold d_bindings_lock
+ */
+bool es_queue::type_registered(int type_id){
+    return type_id >= 0 && (size_t)type_id < d_registered.size() && d_registered[type_id];
+}
+
+/*
+ * publish a fresh copy of the handler count of every type for add_event(),
+ * the caller must hold d_bindings_lock exclusively
+ */
+void es_queue::publish_handler_counts(){
+    boost::shared_ptr< std::vector<int> > counts( new std::vector<int>(d_registered.size(), -1) );
+    for(size_t t=0; t<d_registered.size(); t++){
+        if(d_registered[t])
+            (*counts)[t] = (int)d_bindings[t].size();
+    }
+    d_handler_counts_copies.push_back(counts);
+    d_handler_counts.store(counts.get(), boost::memory_order_release);
 }
 
 
@@ -243,25 +499,23 @@ void es_queue::print_queue(bool already_holding){
 
     printf("EVENTSTREAM_BINDINGS...\n");
 
-    std::map<std::string, std::vector< pmt_t> >::iterator it;
-
-/*    //iterate over all keys in bindings
-    for(it = bindings.begin(); it != bindings.end(); it++){
-        printf(" * EVENT: (%s) # Handlers = %d\n", (*it).first.c_str(), (*it).second.size());
-        //iterate over list items in each key value
-        for(int i=0; i<(*it).second.size(); i++){
-            //print the binding to screen
-            printf("   * Handler--> ");
-            printf("%s\n", pmt_write_string( (*it).second[i] ).c_str() );
-        }
-    }*/
-    printf("%s\n", pmt::write_string( bindings ).c_str() );
-
     if(!already_holding)
         queue_lock.lock();
+    merge_staged();
+
+    boost::shared_lock<boost::shared_mutex> block(d_bindings_lock);
+    //iterate over all registered types
+    for(size_t t=0; t<d_registered.size(); t++){
+        if(!d_registered[t])
+            continue;
+        printf(" * EVENT: (%s) # Handlers = %d\n", pmt::symbol_to_string(es_event_type_symbol(t)).c_str(), (int)d_bindings[t].size());
+        for(size_t i=0; i<d_bindings[t].size(); i++){
+            printf("   * Handler--> %s\n", d_bindings[t][i]->alias().c_str());
+        }
+    }
 
-    printf("EVENTSTREAM_QUEUE (size = %lu)\n", event_queue.size());
-    for(int i=0; i<event_queue.size(); i++){
+    printf("EVENTSTREAM_QUEUE (size = %lu)\n", event_queue.size() + d_soon.size());
+    for(size_t i=0; i<event_queue.size(); i++){
         //event_queue[i].print();
     }
 
@@ -270,51 +524,54 @@ void es_queue::print_queue(bool already_holding){
 
 }
 
-int es_queue::register_event_type(pmt_t type){
-    register_event_type( pmt::symbol_to_string(type) );
+int es_queue::register_event_type(std::string type){
+    return register_event_type( pmt::intern(type) );
 }
 
-int es_queue::register_event_type(std::string type){
+int es_queue::register_event_type(pmt_t type){
 
-    pmt_t type_pmt = pmt::intern(type);
     DEBUG(printf("es_queue::register_event_type...\n");)
-/*    std::map< std::string, std::vector<pmt_t> >::iterator it;
-    it = bindings.find( type );
-    if(it != bindings.end() ){
-        printf("WARNING: type already registered (%s)\n", type.c_str());
-        return -1;
-    }
+    int type_id = es_event_type_id(type);
 
-    std::vector<pmt_t> emptylist;
-    bindings[type] =  emptylist; */
-    bool already_reg = pmt::dict_has_key(bindings, type_pmt);
-    if(already_reg){
-        printf("WARNING: type already registered (%s)\n", type.c_str());
+    boost::unique_lock<boost::shared_mutex> lock(d_bindings_lock);
+    if(type_registered(type_id)){
+        printf("WARNING: type already registered (%s)\n", pmt::symbol_to_string(type).c_str());
     } else {
-        bindings = pmt::dict_add(bindings, type_pmt, PMT_NIL);
+        if((size_t)type_id >= d_registered.size()){
+            d_registered.resize(type_id+1, false);
+            d_bindings.resize(type_id+1);
+            d_stream_bindings.resize(type_id+1);
+        }
+        d_registered[type_id] = true;
+        publish_handler_counts();
     }
     return 0;
 }
 
 void es_queue::bind_handler(pmt_t type, gr::basic_block_sptr handler){
     d_hvec.push_back(handler);
-    bind_handler( pmt::symbol_to_string(type), handler);
+    es_handler_sptr h = boost::dynamic_pointer_cast<es_handler>(handler);
+    bind_handler(type, (es_handler*) h.get() );
     }
 
 void es_queue::bind_handler(std::string type, es_handler* handler){
-    pmt_t handler_pmt = pmt::make_any( handler );
+    bind_handler( pmt::intern(type), handler );
+    }
+
+void es_queue::bind_handler(pmt_t type, es_handler* handler){
 
-    pmt_t type_pmt = pmt::intern(type);
+    int type_id = es_event_type_id(type);
 
-    DEBUG(printf("EVENTSTREAM_QUEUE::BIND_HANDLER (%s, %x).\n",type.c_str(), handler.get());)
+    DEBUG(printf("EVENTSTREAM_QUEUE::BIND_HANDLER (%s, %p).\n",pmt::symbol_to_string(type).c_str(), handler);)
 
-    if(not pmt::dict_has_key(bindings, type_pmt))
+    boost::unique_lock<boost::shared_mutex> lock(d_bindings_lock);
+    if(!type_registered(type_id))
         throw std::runtime_error("attempt to bind handler for unregistered event type");
 
-    DEBUG(printf("Registering new handler for evt type %s\n", type.c_str());)
-    pmt_t handler_list = pmt::dict_ref(bindings, type_pmt, PMT_NIL);
-    handler_list = pmt::list_add(handler_list, handler_pmt);
-    bindings = pmt::dict_add(bindings, type_pmt, handler_list);
+    DEBUG(printf("Registering new handler for evt type %s\n", pmt::symbol_to_string(type).c_str());)
+    d_bindings[type_id].push_back(handler);
+    d_stream_bindings[type_id].push_back( dynamic_cast<es_stream_handler*>(handler) );
+    publish_handler_counts();
 
     }
 
@@ -329,6 +586,8 @@ int es_queue::fetch_next_event(unsigned long long min, unsigned long long max, e
   fstart:
     *eh = NULL;
     queue_lock.lock();
+    merge_staged();
+    flush_soon();
     if(event_queue.size() == 0){
         queue_lock.unlock();
         return false;
@@ -342,8 +601,12 @@ int es_queue::fetch_next_event(unsigned long long min, unsigned long long max, e
                 d_num_discarded++;
                 printf("**WARNING** discarding bad event\n");
                 printf("function call mandates min=%llu & max=%llu\n", min, max);
-                printf("however event[0] start = %llu, end = %llu, type = %s\n", event_queue[0]->time(), event_queue[0]->time() + event_queue[0]->length(), event_type(event_queue[0]->event).c_str());
-                event_queue.erase(event_queue.begin());
+                printf("however event[0] start = %llu, end = %llu, type = %s\n", event_queue[0]->time(), event_queue[0]->time() + event_queue[0]->length(), pmt::symbol_to_string(event_queue[0]->event.type()).c_str());
+                {
+                    es_eh_pair* early = event_queue[0];
+                    queue_pop_front();
+                    delete early;
+                }
                 d_num_events_removed++;
                 queue_lock.unlock();
                 goto fstart;
@@ -351,7 +614,7 @@ int es_queue::fetch_next_event(unsigned long long min, unsigned long long max, e
             case BALK:
                 printf("function call mandates min=%llu & max=%llu\n", min, max);
                 printf("however event[0] start = %llu, end = %llu\n", event_queue[0]->time(), event_queue[0]->time() + event_queue[0]->length());
-                print_queue();
+                print_queue(true);
                 queue_lock.unlock();
                 throw EarlyEventException("event arrived scheduled before allowed buffer!");
                 break;
@@ -359,23 +622,17 @@ int es_queue::fetch_next_event(unsigned long long min, unsigned long long max, e
             case ASAP:
                 // update event time to be as soon as possible
                 d_num_asap++;
-                event_queue[0]->event = event_args_add(event_queue[0]->event, pmt::intern("es::event_time") , pmt::from_uint64(min));
+                queue_reschedule_front(min);
                 //event_print( event_queue[0] );
         }
     }
-    for(int i=0; i<event_queue.size(); i++){
-        es_eh_pair *eh_test = event_queue[i];
-        if(eh_test->time() + eh_test->length() < max){
-            event_queue.erase(event_queue.begin()+i);
-            d_num_events_removed++;
-            queue_lock.unlock();
-            *eh = eh_test;
-            return true;
-        } else {
-            d_num_soon++;
-//            std::cout << "WARNING: skipping event that ends too late! evt:("<<eh_test->time()<<","<<eh_test->time() + eh_test->length() <<") buf:("<<min<<","<<max<<")\n";
-            // sinks should pick this up the next time through ...
-        }
+    // events which end too late are skipped,
+    // sinks should pick them up the next time through ...
+    *eh = queue_take_first(max, true);
+    if(*eh != NULL){
+        d_num_events_removed++;
+        queue_lock.unlock();
+        return true;
     }
     queue_lock.unlock();
     return false;
@@ -384,10 +641,13 @@ int es_queue::fetch_next_event(unsigned long long min, unsigned long long max, e
 int es_queue::fetch_next_event2(unsigned long long min, unsigned long long max, es_eh_pair **eh){
   fstart2:
     *eh = NULL;
+    queue_lock.lock();
+    merge_staged();
+    flush_soon();
     if(event_queue.size() == 0){
+        queue_lock.unlock();
         return false;
     }
-    queue_lock.lock();
     if(event_queue[0]->time() < min){
         printf("early behavior = %d\n", d_early_behavior);
         switch(d_early_behavior){
@@ -397,20 +657,24 @@ int es_queue::fetch_next_event2(unsigned long long min, unsigned long long max,
                 printf("function call mandates min=%llu & max=%llu\n", min, max);
                 printf("however event[0] start = %llu, end = %llu\n", event_queue[0]->time(), event_queue[0]->time() + event_queue[0]->length());
                 //print();
-                event_queue.erase(event_queue.begin());
+                {
+                    es_eh_pair* early = event_queue[0];
+                    queue_pop_front();
+                    delete early;
+                }
                 d_num_events_removed++;
                 queue_lock.unlock();
                 goto fstart2;
             case BALK:
                 printf("function call mandates min=%llu & max=%llu\n", min, max);
                 printf("however event[0] start = %llu, end = %llu\n", event_queue[0]->time(), event_queue[0]->time() + event_queue[0]->length());
-                print_queue();
+                print_queue(true);
                 queue_lock.unlock();
                 throw EarlyEventException("event arrived scheduled before allowed buffer!");
                 break;
             case ASAP:
                 d_num_asap++;
-                event_queue[0]->event = event_args_add(event_queue[0]->event, pmt::intern("es::event_time") , pmt::from_uint64(min));
+                queue_reschedule_front(min);
 //                event_print( event_queue[0]->event );
                 break;
             default:
@@ -422,23 +686,144 @@ int es_queue::fetch_next_event2(unsigned long long min, unsigned long long max,
         //printf("event arrived scheduled before allowed buffer!\n");
         //print();
     }
-    for(int i=0; i<event_queue.size(); i++){
-        es_eh_pair* eh_test = event_queue[i];
-        if(eh_test->time() < max){
-            event_queue.erase(event_queue.begin()+i);
-            d_num_events_removed++;
-            queue_lock.unlock();
-            *eh = eh_test;
-            DEBUG(printf("es_queue::fetch_next_event2() returning true!! es_eh_pair = %x\n", *eh);)
-            DEBUG(printf("es_queue::fetch_next_event2() pair.handler = %x\n", &(*((*eh)->handler)) );)
-            return true;
-        }
-        else{
-            d_num_soon++;
-        }
+    *eh = queue_take_first(max, false);
+    if(*eh != NULL){
+        d_num_events_removed++;
+        queue_lock.unlock();
+        DEBUG(printf("es_queue::fetch_next_event2() returning true!! es_eh_pair = %x\n", *eh);)
+        DEBUG(printf("es_queue::fetch_next_event2() pair.handler = %p\n", (*eh)->handler );)
+        return true;
     }
 
     queue_lock.unlock();
     return false;
 
 }
+
+/**
+ * @brief Remove every event which fits in the buffer window in one pass.
+ *
+ * Early events are handled per d_early_behavior first, then every event
+ * with time + length < max, or time < max for streaming handlers, is
+ * moved into out in time order under a single acquisition of queue_lock.  Events which end too late stay
+ * queued and are counted in d_num_soon.
+ *
+ * @param [in] min Earliest sample time currently available.
+ * @param [in] max Upper bound of the sample times currently available.
+ * @param [out] out Fetched eh pairs are appended here, the caller takes
+ *   ownership of them.
+ *
+ * @return Number of eh pairs appended to out.
+ */
+int es_queue::fetch_ready_events(unsigned long long min, unsigned long long max, std::vector<es_eh_pair*> &out){
+    size_t nstart = out.size();
+    boost::mutex::scoped_lock lock(queue_lock);
+    merge_staged();
+
+    // pending events which are now early get the early behavior below
+    size_t nearly = 0;
+    while(nearly < d_soon.size() && d_soon[nearly]->time() < min){
+        queue_insert(d_soon[nearly++]);
+    }
+    d_soon.erase(d_soon.begin(), d_soon.begin()+nearly);
+
+    if(event_queue.empty() && d_soon.empty())
+        return 0;
+    d_event_time = earliest_time();
+
+    // deal with everything scheduled before the buffer
+    std::vector<es_eh_pair*> asap;
+    while(!event_queue.empty() && event_queue[0]->time() < min){
+        es_eh_pair* early = event_queue[0];
+        switch(d_early_behavior){
+            case DISCARD:
+                d_num_discarded++;
+                printf("**WARNING** discarding bad event\n");
+                printf("function call mandates min=%llu & max=%llu\n", min, max);
+                printf("however event[0] start = %llu, end = %llu, type = %s\n", early->time(), early->time() + early->length(), pmt::symbol_to_string(early->event.type()).c_str());
+                queue_pop_front();
+                d_num_events_removed++;
+                delete early;
+                break;
+            case BALK:
+                printf("function call mandates min=%llu & max=%llu\n", min, max);
+                printf("however event[0] start = %llu, end = %llu\n", early->time(), early->time() + early->length());
+                print_queue(true);
+                throw EarlyEventException("event arrived scheduled before allowed buffer!");
+            case ASAP:
+                d_num_asap++;
+                queue_pop_front();
+                early->set_time(min);
+                asap.push_back(early);
+                break;
+            default:
+                throw std::runtime_error("invalid early event behavior mode!");
+        }
+    }
+    for(size_t i=0; i<asap.size(); i++){
+        queue_insert(asap[i]);
+    }
+
+    if(d_search_behavior == SEARCH_HEAP){
+        // events already due but not yet complete wait in d_soon (in time
+        // order) instead of being popped and pushed back every call
+        size_t keep = 0;
+        for(size_t i=0; i<d_soon.size(); i++){
+            es_eh_pair* eh = d_soon[i];
+            if(eh->time() + eh->length() < max){
+                out.push_back(eh);
+            } else {
+                d_num_soon++;
+                d_soon[keep++] = eh;
+            }
+        }
+        d_soon.resize(keep);
+
+        size_t nsoon = out.size();
+        while(!event_queue.empty() && event_queue[0]->time() < max){
+            es_eh_pair* eh = event_queue[0];
+            queue_pop_front();
+            if(eh->stream || eh->time() + eh->length() < max){
+                out.push_back(eh);
+            } else {
+                d_num_soon++;
+                d_soon.insert(std::upper_bound(d_soon.begin(), d_soon.end(), eh, time_compare), eh);
+            }
+        }
+        std::inplace_merge(out.begin()+nstart, out.begin()+nsoon, out.end(), time_compare);
+    } else {
+        // compact the sorted vector in place, kept events slide down
+        size_t keep = 0, i = 0;
+        for(; i<event_queue.size() && event_queue[i]->time() < max; i++){
+            es_eh_pair* eh = event_queue[i];
+            if(eh->stream || eh->time() + eh->length() < max){
+                out.push_back(eh);
+            } else {
+                d_num_soon++;
+                event_queue[keep++] = eh;
+            }
+        }
+        event_queue.erase(event_queue.begin()+keep, event_queue.begin()+i);
+    }
+
+    d_num_events_removed += out.size() - nstart;
+    return out.size() - nstart;
+}
+
+/**
+ * @brief Give back eh pairs taken by fetch_ready_events() but not used.
+ *
+ * The pairs are inserted again in time order and no longer count as
+ * removed, the caller gives up ownership of them.
+ *
+ * @param [in] events Fetched eh pairs.
+ * @param [in] first Index of the first pair in events to give back.
+ */
+void es_queue::requeue_events(std::vector<es_eh_pair*> &events, size_t first){
+    boost::mutex::scoped_lock lock(queue_lock);
+    for(size_t i=first; i<events.size(); i++){
+        queue_insert(events[i]);
+    }
+    if(first < events.size())
+        d_num_events_removed -= events.size() - first;
+}
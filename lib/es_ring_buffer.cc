@@ -0,0 +1,144 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of gr-eventstream
+ *
+ * gr-eventstream is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * gr-eventstream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gr-eventstream; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <es/es_ring_buffer.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+
+#define DEBUG(X)
+//#define DEBUG(X)  X
+
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
+// huge page size assumed when rounding a hugepage backed ring
+static const size_t HUGEPAGE_SIZE = 2*1024*1024;
+
+/*
+ * anonymous file to back the ring, memfd where the kernel has it,
+ * otherwise an unlinked file in /dev/shm
+ */
+static int ring_fd(bool hugepages)
+{
+#ifdef SYS_memfd_create
+    int fd = syscall(SYS_memfd_create, "es_ring_buffer", hugepages ? MFD_HUGETLB : 0);
+    if(fd >= 0 || hugepages)
+        return fd;
+#else
+    if(hugepages)
+        return -1;
+#endif
+    char path[] = "/dev/shm/es_ring_buffer_XXXXXX";
+    int tfd = mkstemp(path);
+    if(tfd >= 0)
+        unlink(path);
+    return tfd;
+}
+
+es_ring_buffer::es_ring_buffer(size_t itemsize, uint64_t min_items, bool hugepages) :
+    d_itemsize(itemsize),
+    d_nbytes(0),
+    d_capacity(0),
+    d_first(0),
+    d_end(0),
+    d_base(NULL)
+{
+    if(itemsize == 0 || min_items == 0)
+        throw std::runtime_error("es_ring_buffer: itemsize and size must be non zero");
+
+    if(hugepages && !map(itemsize*min_items, true)){
+        printf("WARNING: es_ring_buffer could not map huge pages, using normal pages\n");
+        hugepages = false;
+    }
+    if(!hugepages && !map(itemsize*min_items, false))
+        throw std::runtime_error("es_ring_buffer: unable to map double mapped ring");
+
+    d_capacity = d_nbytes / d_itemsize;
+    DEBUG(printf("es_ring_buffer: %lu bytes, %llu items\n", d_nbytes, (unsigned long long)d_capacity);)
+}
+
+/*
+ * reserve twice the ring size of address space then map the same file
+ * over both halves
+ */
+bool es_ring_buffer::map(size_t nbytes, bool hugepages)
+{
+    size_t page = hugepages ? HUGEPAGE_SIZE : sysconf(_SC_PAGESIZE);
+    nbytes = ((nbytes + page - 1) / page) * page;
+
+    int fd = ring_fd(hugepages);
+    if(fd < 0)
+        return false;
+    if(ftruncate(fd, nbytes) != 0){
+        close(fd);
+        return false;
+    }
+
+    void* base = mmap(NULL, 2*nbytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED){
+        close(fd);
+        return false;
+    }
+    void* lo = mmap(base, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    void* hi = mmap((uint8_t*)base + nbytes, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    close(fd);
+    if(lo != base || hi != (uint8_t*)base + nbytes){
+        munmap(base, 2*nbytes);
+        return false;
+    }
+
+    d_base = (uint8_t*) base;
+    d_nbytes = nbytes;
+    return true;
+}
+
+es_ring_buffer::~es_ring_buffer()
+{
+    if(d_base)
+        munmap(d_base, 2*d_nbytes);
+}
+
+void es_ring_buffer::push(const void* items, uint64_t n)
+{
+    const uint8_t* src = (const uint8_t*) items;
+    // only the newest capacity items can survive
+    if(n > d_capacity){
+        src += (n - d_capacity)*d_itemsize;
+        d_end += n - d_capacity;
+        n = d_capacity;
+    }
+    memcpy( d_base + (d_end*d_itemsize) % d_nbytes, src, n*d_itemsize );
+    d_end += n;
+}
+
+const uint8_t* es_ring_buffer::at(uint64_t item) const
+{
+    return d_base + (item*d_itemsize) % d_nbytes;
+}
@@ -33,11 +33,20 @@
 
 #include <es/es.h>
 #include <gnuradio/io_signature.h>
+#include <es/es_affinity.h>
+#include <boost/functional/hash.hpp>
+#include <set>
+#include <sstream>
 #include <stdio.h>
 
 #define DEBUG(X)
 //#define DEBUG(X) X
 
+// the pool grows by one once the average handler thread utilization over
+// at least this many work() calls since it last changed reaches the limit
+static const size_t AUTOSCALE_GROW_SAMPLES = 4;
+static const double AUTOSCALE_GROW_UTILIZATION = 90.0;
+
 /*
  * Create a new instance of es_sink and return
  * a boost shared_ptr.  This is effectively the public constructor.
@@ -49,10 +58,12 @@ es_make_sink (
     int sample_history_in_kilosamples,
     enum es_queue_early_behaviors eb,
     enum es_search_behaviors sb,
-    enum es_congestion_behaviors cb)
+    enum es_congestion_behaviors cb,
+    enum es_scheduling_policies sp,
+    int queue_capacity)
 {
   return es_sink_sptr (
-    new es_sink (insig,n_threads,sample_history_in_kilosamples,eb,sb,cb));
+    new es_sink (insig,n_threads,sample_history_in_kilosamples,eb,sb,cb,sp,queue_capacity));
 }
 
 /*
@@ -76,22 +87,42 @@ es_sink::es_sink (
   int _sample_history_in_kilosamples,
   enum es_queue_early_behaviors eb,
   enum es_search_behaviors sb,
-  enum es_congestion_behaviors cb)
+  enum es_congestion_behaviors cb,
+  enum es_scheduling_policies sp,
+  int queue_capacity)
     : gr::sync_block (
         "es_sink",
         es_make_io_signature(insig.size(), insig),
         gr::io_signature::make (MIN_OUT, MAX_OUT, 0)),
+        d_tag_horizon(0),
         n_threads(_n_threads),
-        d_nevents(0),
         sample_history_in_kilosamples(_sample_history_in_kilosamples),
-        qq(100), dq(100), d_num_running_handlers(0),
+        d_nevents(0),
+        qq(queue_capacity), dq(queue_capacity),
+        d_ring_horizon(0),
+        d_gr_min_time(0),
+        d_memory_budget(0), d_inflight_bytes(0), d_type_flags_changed(false),
+        d_coalesce(false), d_num_running_handlers(0),
         d_avg_ratio(tag::rolling_window::window_size=50),
         d_avg_thread_utilization(tag::rolling_window::window_size=50),
-        latest_tags(pmt::make_dict()),
         d_search_behavior(sb),
-        d_congestion_behavior(cb)
+        d_congestion_behavior(cb),
+        d_executor_weight(1),
+        d_scheduling_policy(sp),
+        d_order_key(PMT_NIL),
+        d_max_threads(_n_threads),
+        d_localize(false),
+        d_work_node(-1),
+        d_node_next(0)
 {
+    if(queue_capacity <= 0)
+        throw std::runtime_error("es_sink: queue_capacity must be at least 1");
     event_acceptor_setup(eb, sb);
+    qq.set_policy(sp, n_threads);
+    // events beyond this many waiting for a handler are dropped or block
+    qq.set_limit(queue_capacity);
+    // fixed size until set_thread_limits()
+    d_pool.min_threads = n_threads;
 
     d_time = 0;
     d_history = 1024*sample_history_in_kilosamples;
@@ -123,10 +154,181 @@ es_sink::~es_sink ()
 }
 
 bool es_sink::start(){
+    qq.open();
+    if(d_executor){
+        // handlers run on the shared executor's threads
+        if(d_scheduling_policy == SCHEDULE_KEYED)
+            printf("WARNING: es_sink: keyed ordering is not kept on a shared executor\n");
+        d_executor->attach(this, d_executor_weight);
+        return true;
+    }
+
     // instantiate the threadpool workers
+    d_pool.live = 0;
     for(int i=0; i<n_threads; i++){
-        boost::shared_ptr<es_event_loop_thread> th( new es_event_loop_thread(pmt::PMT_NIL, event_queue, &qq, &dq, &qq_cond, &d_nevents, &d_num_running_handlers) );
-        threadpool.push_back( th );
+        spawn_thread();
+    }
+    return true;
+}
+
+void
+es_sink::spawn_thread()
+{
+    boost::mutex::scoped_lock lock(d_threadpool_lock);
+
+    // take the lowest lane, and so cpu, no live thread holds, lanes of
+    // retired threads are given out again
+    std::vector<bool> taken(threadpool.size() + 1, false);
+    for(size_t i=0; i<threadpool.size(); i++){
+        if(!threadpool[i]->exited() && threadpool[i]->lane() < (int)taken.size())
+            taken[threadpool[i]->lane()] = true;
+    }
+    int lane = std::find(taken.begin(), taken.end(), false) - taken.begin();
+
+    std::vector<int> cpus;
+    if(!d_cpus.empty())
+        cpus = es_node_cpus(d_cpus, d_cpus[lane % d_cpus.size()]);
+    boost::shared_ptr<es_event_loop_thread> th( new es_event_loop_thread(pmt::PMT_NIL, event_queue, &qq, &dq, &d_nevents, &d_num_running_handlers, lane, &d_pool, cpus) );
+    threadpool.push_back( th );
+    d_pool.live++;
+}
+
+void
+es_sink::set_thread_affinity(std::vector<int> cpus, bool localize)
+{
+    d_cpus = cpus;
+    d_localize = false;
+    d_node_lanes.clear();
+    if(!localize || cpus.empty())
+        return;
+
+    if(d_scheduling_policy == SCHEDULE_KEYED || d_scheduling_policy == SCHEDULE_EDF){
+        printf("WARNING: es_sink: NUMA local dispatch does not apply to keyed or EDF scheduling\n");
+        return;
+    }
+    if(d_max_threads > d_pool.min_threads){
+        printf("WARNING: es_sink: NUMA local dispatch needs a fixed size handler pool\n");
+        return;
+    }
+    d_work_node = es_cpu_node(cpus[0]);
+    if(d_work_node < 0){
+        printf("WARNING: es_sink: no NUMA node known for cpu %d, not localizing\n", cpus[0]);
+        return;
+    }
+    if(qq.nlanes() == 0){
+        // a lane per thread, idle threads still take other nodes' events
+        printf("WARNING: es_sink: NUMA local dispatch switches FIFO scheduling to work stealing\n");
+        d_scheduling_policy = SCHEDULE_STEAL;
+        qq.set_policy(SCHEDULE_STEAL, n_threads);
+    }
+
+    // thread i serves lane i and is pinned to the node of cpus[i % cpus.size()]
+    for(int lane=0; lane<qq.nlanes(); lane++){
+        int node = es_cpu_node(cpus[lane % cpus.size()]);
+        if(node < 0)
+            continue;
+        if(node >= (int)d_node_lanes.size())
+            d_node_lanes.resize(node+1);
+        d_node_lanes[node].push_back(lane);
+    }
+
+    // copies are made by work(), keep it on the first cpu's node so they
+    // are local to that node's handler threads
+    set_processor_affinity(es_node_cpus(cpus, cpus[0]));
+    d_localize = d_work_node < (int)d_node_lanes.size() && !d_node_lanes[d_work_node].empty();
+}
+
+// lane of a thread on the node work() is pinned to
+int
+es_sink::local_lane()
+{
+    const std::vector<int> &lanes = d_node_lanes[d_work_node];
+    return lanes[d_node_next++ % lanes.size()];
+}
+
+std::string
+es_sink::thread_placement()
+{
+    if(d_executor)
+        return "executor";
+    std::ostringstream ss;
+    boost::mutex::scoped_lock lock(d_threadpool_lock);
+    for(size_t i=0; i<threadpool.size(); i++){
+        if(threadpool[i]->exited())
+            continue;
+        if(ss.tellp() > 0)
+            ss << " ";
+        std::vector<int> cpus = threadpool[i]->cpus();
+        if(cpus.empty())
+            ss << "-";
+        else
+            ss << "cpu" << es_cpu_list(cpus) << "/node" << threadpool[i]->node();
+    }
+    return ss.str();
+}
+
+void
+es_sink::set_thread_limits(int min_threads, int max_threads, int idle_ms)
+{
+    // max_threads 0 turns autoscaling off, the pool stays at n_threads
+    if(max_threads <= 0){
+        d_pool.min_threads = n_threads;
+        d_max_threads = n_threads;
+        d_pool.idle_ms = 0;
+        return;
+    }
+
+    // never retire the last thread, queued events would be stranded
+    min_threads = std::max(min_threads, 1);
+    max_threads = std::max(max_threads, min_threads);
+    if(qq.nlanes() > 0 && max_threads != min_threads){
+        printf("WARNING: es_sink: only FIFO and EDF handler pools can be autoscaled\n");
+        return;
+    }
+    d_pool.min_threads = min_threads;
+    d_max_threads = max_threads;
+    d_pool.idle_ms = (d_max_threads > d_pool.min_threads) ? idle_ms : 0;
+}
+
+int
+es_sink::num_threads()
+{
+    return d_executor ? 0 : (int)d_pool.live;
+}
+
+/*
+ * called from work(), joins threads which retired themselves and adds
+ * one once the thread utilization has stayed high with events still
+ * queued, or at once if the queue is full
+ */
+void
+es_sink::autoscale(bool full)
+{
+    {
+        boost::mutex::scoped_lock lock(d_threadpool_lock);
+        size_t keep = 0;
+        for(size_t i=0; i<threadpool.size(); i++){
+            if(threadpool[i]->exited())
+                threadpool[i]->join();
+            else
+                threadpool[keep++] = threadpool[i];
+        }
+        threadpool.resize(keep);
+    }
+
+    // sampled on every call so idle stretches count against growing
+    double utilization = event_thread_utilization();
+    int live = d_pool.live;
+    if(live >= d_max_threads || qq.size() == 0)
+        return;
+
+    boost::mutex::scoped_lock lock(d_utilization_lock);
+    if(full || (rolling_count(d_avg_thread_utilization) >= AUTOSCALE_GROW_SAMPLES &&
+            utilization >= AUTOSCALE_GROW_UTILIZATION)){
+        DEBUG(printf("es_sink: growing handler pool to %d threads\n", live+1);)
+        spawn_thread();
+        // samples against the old pool size no longer apply
+        d_avg_thread_utilization = acc_avg_t(tag::rolling_window::window_size=50);
     }
 }
 
@@ -134,12 +336,71 @@ bool es_sink::stop(){
     //printf("es_sink::stop running!\n");
     wait_events();
 
+    if(d_executor){
+        d_executor->detach(this);
+        return true;
+    }
+
     //printf("waiting for join\n");
-    // stop all the threads in the pool
-    for(int i=0; i<n_threads; i++){
-        threadpool[i]->stop();
+    // stop all the threads in the pool, taken out under the lock so
+    // ControlPort never walks it while they are joined
+    std::vector<boost::shared_ptr<es_event_loop_thread> > pool;
+    {
+        boost::mutex::scoped_lock lock(d_threadpool_lock);
+        pool.swap(threadpool);
+    }
+    for(size_t i=0; i<pool.size(); i++){
+        pool[i]->stop();
     }
-    threadpool.clear();
+    return true;
+}
+
+void
+es_sink::set_executor(es_executor_sptr executor, int weight)
+{
+    d_executor = executor;
+    d_executor_weight = weight;
+}
+
+/*
+ * called by the shared executor's workers
+ */
+bool
+es_sink::run_one()
+{
+    es_eh_pair* eh = NULL;
+    bool found = qq.pop(eh);
+    // keyed lanes are never stolen from, look in each of them
+    for(int l=1; !found && l<qq.nlanes(); l++)
+        found = qq.pop(eh, l);
+    if(!found)
+        return false;
+    es_event_loop_thread::run_pair(eh, &dq, &d_nevents, &d_num_running_handlers);
+    return true;
+}
+
+/*
+ * work queue lane of an event under SCHEDULE_KEYED, equal keys always
+ * map to the same lane and so the same handler thread
+ */
+int
+es_sink::order_lane(es_event &event)
+{
+    if(d_scheduling_policy != SCHEDULE_KEYED || pmt::is_null(d_order_key) ||
+            !event.has_arg(d_order_key))
+        return -1;
+
+    pmt_t key = event.arg(d_order_key);
+    size_t h;
+    if(pmt::is_integer(key))
+        h = (size_t) pmt::to_long(key);
+    else if(pmt::is_uint64(key))
+        h = (size_t) pmt::to_uint64(key);
+    else if(pmt::is_symbol(key))
+        h = boost::hash<std::string>()(pmt::symbol_to_string(key));
+    else
+        h = boost::hash<std::string>()(pmt::write_string(key));
+    return (int)(h % std::max(qq.nlanes(), 1));
 }
 
 void
@@ -291,6 +552,66 @@ es_sink::setup_rpc()
         )
     );
 
+    add_rpc_variable(
+        rpcbasic_sptr(new rpcbasic_register_get<es_sink, uint64_t>(
+            alias(), "inflight bytes",
+            &es_sink::inflight_bytes,
+            pmt::mp(0.0f), pmt::mp(0.0f), pmt::mp(0.0f),
+            "bytes", "Bytes of event buffers waiting for or running in handlers.", RPC_PRIVLVL_MIN,
+            DISPTIME | DISPOPTSTRIP)
+        )
+    );
+
+    add_rpc_variable(
+        rpcbasic_sptr(new rpcbasic_register_get<es_sink, uint64_t>(
+            alias(), "npairs pool hits",
+            &es_sink::pair_pool_hits,
+            pmt::mp(0.0f), pmt::mp(0.0f), pmt::mp(0.0f),
+            "count", "Num eh pairs allocated from the pair pool free list.", RPC_PRIVLVL_MIN,
+            DISPTIME | DISPOPTSTRIP)
+        )
+    );
+
+    add_rpc_variable(
+        rpcbasic_sptr(new rpcbasic_register_get<es_sink, uint64_t>(
+            alias(), "npairs pool misses",
+            &es_sink::pair_pool_misses,
+            pmt::mp(0.0f), pmt::mp(0.0f), pmt::mp(0.0f),
+            "count", "Num eh pair allocations which had to grow the pair pool.", RPC_PRIVLVL_MIN,
+            DISPTIME | DISPOPTSTRIP)
+        )
+    );
+
+    add_rpc_variable(
+        rpcbasic_sptr(new rpcbasic_register_get<es_sink, int>(
+            alias(), "nthreads live",
+            &es_sink::num_threads,
+            pmt::mp(0.0f), pmt::mp(0.0f), pmt::mp(0.0f),
+            "count", "Num handler threads currently in the pool.", RPC_PRIVLVL_MIN,
+            DISPTIME | DISPOPTSTRIP)
+        )
+    );
+
+    add_rpc_variable(
+        rpcbasic_sptr(new rpcbasic_register_get<es_sink, std::string>(
+            alias(), "thread placement",
+            &es_sink::thread_placement,
+            pmt::mp(""), pmt::mp(""), pmt::mp(""),
+            "", "cpu/NUMA node of each handler thread.", RPC_PRIVLVL_MIN,
+            DISPNULL)
+        )
+    );
+
+    add_rpc_variable(
+        rpcbasic_sptr(new rpcbasic_register_get<es_sink, uint64_t>(
+            alias(), "nevents stolen",
+            &es_sink::num_steals,
+            pmt::mp(0.0f), pmt::mp(0.0f), pmt::mp(0.0f),
+            "count", "Num events a handler thread took from another thread's queue.", RPC_PRIVLVL_MIN,
+            DISPTIME | DISPOPTSTRIP)
+        )
+    );
+
     add_rpc_variable(
         rpcbasic_sptr(new rpcbasic_register_get<es_sink, double>(
             alias(), "eventAvgRunRatio",
@@ -373,6 +694,52 @@ es_sink::event_queue_size()
     return (uint64_t)event_queue->length();
 }
 
+void
+es_sink::set_zero_copy(std::string type, bool enable)
+{
+    int type_id = es_event_type_id(pmt::intern(type));
+    boost::mutex::scoped_lock lock(d_type_flags_lock);
+    if((size_t)type_id >= d_zero_copy.size())
+        d_zero_copy.resize(type_id+1, false);
+    d_zero_copy[type_id] = enable;
+    d_type_flags_changed = true;
+}
+
+void
+es_sink::set_inline(std::string type, bool enable)
+{
+    int type_id = es_event_type_id(pmt::intern(type));
+    boost::mutex::scoped_lock lock(d_type_flags_lock);
+    if((size_t)type_id >= d_inline.size())
+        d_inline.resize(type_id+1, false);
+    d_inline[type_id] = enable;
+    d_type_flags_changed = true;
+}
+
+uint64_t
+es_sink::inflight_bytes()
+{
+    return d_inflight_bytes;
+}
+
+uint64_t
+es_sink::pair_pool_hits()
+{
+    return event_queue->pair_pool().hits();
+}
+
+uint64_t
+es_sink::pair_pool_misses()
+{
+    return event_queue->pair_pool().misses();
+}
+
+uint64_t
+es_sink::num_steals()
+{
+    return qq.steals();
+}
+
 double
 es_sink::event_run_ratio()
 {
@@ -391,118 +758,249 @@ es_sink::event_thread_utilization()
 {
     double ret = 0.0;
 
-    if (n_threads > 0)
+    int live = d_pool.live;
+    if (live > 0)
     {
-        ret = (double)((double) d_num_running_handlers / n_threads) * 100.0;
+        ret = (double)((double) d_num_running_handlers / live) * 100.0;
     }
+    // work() samples it for autoscaling as well as ControlPort
+    boost::mutex::scoped_lock lock(d_utilization_lock);
     d_avg_thread_utilization(ret);
     return rolling_mean(d_avg_thread_utilization);
 }
 
-/**
- * @brief Search forward through live_event_times to find an insertion index.
- *
- * Search forward starting at the beginning of the live_event_times list and
- * continuing until either an appropriate insertion index is found or the end
- * of the list is reached.
- *
- * @param [in] evt_time Event time to insert into the live_event_times list.
- *
- * @return Index at which evt_time should be inserted to maintain sort.
- */
-size_t
-es_sink::find_forward(const uint64_t& evt_time)
+void
+es_sink::set_external_history(uint64_t nitems, bool hugepages)
 {
-  size_t idx = 0, sz = live_event_times.size();
-  for (idx = 0; idx < sz && evt_time > live_event_times[idx]; idx++){}
-  return idx;
+    d_rings.clear();
+    if(nitems == 0)
+        return;
+    // the ring must reach at least as far back as the regular history
+    nitems = std::max(nitems, (uint64_t)d_history);
+    for(int i=0; i<d_input_signature->max_streams(); i++){
+        es_ring_buffer_sptr ring(new es_ring_buffer(d_input_signature->sizeof_stream_item(i), nitems, hugepages));
+        ring->set_first(d_time);
+        d_rings.push_back(ring);
+    }
+    d_ring_horizon = d_time;
 }
 
-/**
- * @brief Search backward through live_event_times to find an insertion index.
- *
- * Search backward starting at the end of the live_event_times list and
- * continuing until either an appropriate insertion index is found or the
- * beginning of the list is reached.
- *
- * @param [in] evt_time Event time to insert into the live_event_times list.
- *
- * @return Index at which evt_time should be inserted to maintain sort.
+uint64_t
+es_sink::external_history()
+{
+    return d_rings.empty() ? 0 : d_rings[0]->capacity();
+}
+
+// copy the items of this call not yet seen into the rings
+void
+es_sink::ring_append(gr_vector_const_void_star &input_items, uint64_t max_time)
+{
+    uint64_t from = std::max(d_ring_horizon, (uint64_t)d_time);
+    if(from >= max_time)
+        return;
+    for(size_t i=0; i<d_rings.size(); i++){
+        d_rings[i]->push( item_ptr(i, from, input_items), max_time - from );
+    }
+    d_ring_horizon = max_time;
+}
+
+// address of an absolute item, from input_items while it is there else the ring
+const uint8_t*
+es_sink::item_ptr(int i, uint64_t item, gr_vector_const_void_star &input_items)
+{
+    if(item < d_gr_min_time)
+        return d_rings[i]->at(item);
+    return (const uint8_t*) input_items[i] + (item - d_time + d_history - 1)*d_input_signature->sizeof_stream_item(i);
+}
+
+// start delivering an event to its streaming handler
+void
+es_sink::begin_stream(es_eh_pair* eh)
+{
+    d_nevents++;
+    eh->event.merge_args( tags_in(eh->time(), eh->time() + 1) );
+    eh->stream->stream_begin( eh->event );
+    es_sink_stream s = { eh, eh->time() };
+    d_streams.push_back(s);
+}
+
+/*
+ * hand every active stream the samples it has not seen up to max_time,
+ * straight out of the input buffer (or ring), and end those which are done.
+ * at the end of a file no more samples will come so all streams are ended.
  */
-size_t
-es_sink::find_reverse(const uint64_t& evt_time)
+void
+es_sink::service_streams(gr_vector_const_void_star &input_items, uint64_t max_time, bool flush)
+{
+    gr_vector_const_void_star chunk(input_items.size());
+    size_t keep = 0;
+    for(size_t k=0; k<d_streams.size(); k++){
+        es_sink_stream &s = d_streams[k];
+        uint64_t end = s.eh->time() + s.eh->length();
+        uint64_t upto = std::min(end, max_time);
+        if(upto > s.pos){
+            for(size_t i=0; i<input_items.size(); i++)
+                chunk[i] = item_ptr(i, s.pos, input_items);
+            s.eh->stream->stream_chunk( s.eh->event, s.pos - s.eh->time(), chunk, (int)(upto - s.pos) );
+            s.pos = upto;
+        }
+        if(s.pos == end || flush){
+            s.eh->stream->stream_end( s.eh->event );
+            delete s.eh;
+            d_nevents--;
+        } else {
+            d_streams[keep++] = s;
+        }
+    }
+    d_streams.resize(keep);
+}
+
+static bool
+tag_offset_compare(const gr::tag_t &a, const gr::tag_t &b)
 {
-  size_t sz = live_event_times.size(), idx = 0;
+    return a.offset < b.offset;
+}
 
-  // If nothing is in the vector then the insertion index must be 0.
-  if (sz == 0)
-  {
-    return 0;
-  }
+/*
+ * Add newly seen tags of every input to d_tag_index and drop entries which
+ * can no longer be the latest tag before an event window, keeping the
+ * last one before min_time.  Tags are read again while their samples are
+ * unconsumed, only those at or beyond d_tag_horizon are new, range_end is
+ * the end of this read.
+ */
+void
+es_sink::index_tags(std::vector<gr::tag_t> &tags, uint64_t range_end, uint64_t min_time)
+{
+    std::stable_sort(tags.begin(), tags.end(), tag_offset_compare);
+    for(size_t i=0; i<tags.size(); i++){
+        if(tags[i].offset >= d_tag_horizon)
+            d_tag_index.push_back(tags[i]);
+    }
+    d_tag_horizon = std::max(d_tag_horizon, range_end);
 
-  for (idx = sz; idx-- > 0 && evt_time < live_event_times[idx];){}
+    while(d_tag_index.size() > 1 && d_tag_index[1].offset < min_time)
+        d_tag_index.pop_front();
+}
 
-  return idx + 1;
+static pmt_t
+tag_dict_add(pmt_t dict, const gr::tag_t &tag)
+{
+    return pmt::dict_add(dict, tag.key, pmt::cons(pmt::from_uint64(tag.offset), tag.value));
 }
 
-/**
- * @brief Comparison function used by the binary search method find_binary().
- *
- * @param [in] vval Reference to an item in the live_event_times vector (vector
- *   value).
- * @param [in] cval Reference to an item to be inserted into the
- *   live_event_times vector (comparison value).
+/*
+ * dict of the tags in [start, end) plus the latest one before start,
+ * a key tagged more than once keeps its latest tag
  */
-bool sink_compare(const uint64_t& vval, const uint64_t& cval)
+pmt_t
+es_sink::tags_in(uint64_t start, uint64_t end)
 {
-  return cval > vval;
-};
+    gr::tag_t first;
+    first.offset = start;
+    std::deque<gr::tag_t>::iterator it =
+        std::lower_bound(d_tag_index.begin(), d_tag_index.end(), first, tag_offset_compare);
+
+    pmt_t dict = pmt::make_dict();
+    if(it != d_tag_index.begin())
+        dict = tag_dict_add(dict, *(it-1));
+    for(; it != d_tag_index.end() && it->offset < end; it++)
+        dict = tag_dict_add(dict, *it);
+    return dict;
+}
 
-/**
- * @brief Search through a sorted list using a binary pattern to find an
- *   insertion index.
- *
- * Search using a binary pattern starting at the beginning of the
- * live_event_times list and continuing until either an appropriate insertion
- * index is found or the binary search is exhausted.
- *
- * @param [in] evt_time Event time to insert into the live_event_times list.
- *
- * @return Index at which evt_time should be inserted to maintain sort.
+/*
+ * Group the dispatched events (in time order) into spans of overlapping or
+ * adjacent windows and copy each span out of the input buffer once.
+ * Only handlers reading buf natively can take a view into a span, the
+ * others and zero-copy events are left out.
  */
-size_t
-es_sink::find_binary(const uint64_t& evt_time)
+void
+es_sink::plan_spans(gr_vector_const_void_star &input_items)
 {
-    return std::lower_bound(
-      live_event_times.begin(),
-      live_event_times.end(),
-      evt_time,
-      sink_compare) - live_event_times.begin();
+    d_spans.clear();
+    d_span_of.assign(d_ready.size(), -1);
+
+    for(size_t k=0; k<d_ready.size(); k++){
+        es_eh_pair* eh = d_ready[k];
+        if(eh->stream || zero_copy_pair(eh) || !eh->handler->native_buffers())
+            continue;
+        uint64_t start = eh->time(), end = eh->time() + eh->length();
+        if(d_spans.empty() || start > d_spans.back().end){
+            es_sink_span span = { start, end, true, { PMT_NIL, NULL } };
+            d_spans.push_back(span);
+        } else {
+            es_sink_span &span = d_spans.back();
+            span.single = span.single && start == span.start && end == span.end;
+            if(end > span.end){
+                span.end = end;
+                span.single = false;
+            }
+        }
+        d_span_of[k] = d_spans.size() - 1;
+    }
+
+    for(size_t s=0; s<d_spans.size(); s++){
+        es_sink_span &span = d_spans[s];
+        span.copy.buf = PMT_NIL;
+        span.copy.charge = new_charge(0);
+        for(size_t i=0; i<input_items.size(); i++){
+            size_t itemsize = d_input_signature->sizeof_stream_item(i);
+            span.copy.buf = pmt::list_add(span.copy.buf, pmt::init_u8vector( itemsize*(span.end - span.start),
+                item_ptr(i, span.start, input_items) ));
+            span.copy.charge->nbytes += itemsize*(span.end - span.start);
+        }
+    }
 }
 
-/**
- * @brief Search using the preconfigured search type for an insertion index.
- *
- * This is a wrapper method to call the appropriate search method based on the
- * value of the d_search_behavior member variable.
- *
- * @param [in] evt_time Event time to insert into the live_event_times list.
- *
- * @return Index at which evt_time should be inserted to maintain sort.
+/*
+ * The number of ready events (in time order) dispatched under the memory
+ * budget, a window shared by several handlers is counted once.  With
+ * nothing in flight one event is let through so an event larger than the
+ * budget still runs.  Spans are at most the sum of their windows, so
+ * coalescing the admitted events never goes over.
  */
-int es_sink::find_index(const uint64_t& evt_time)
+size_t
+es_sink::admit_events(size_t ninputs, uint64_t budget)
 {
-    switch(d_search_behavior)
-    {
-        case SEARCH_BINARY:
-            return find_binary(evt_time);
-        case SEARCH_REVERSE:
-            return find_reverse(evt_time);
-        case SEARCH_FORWARD:
-            return find_forward(evt_time);
-        default:
-            return find_forward(evt_time);
+    uint64_t item_bytes = 0;
+    for(size_t i=0; i<ninputs; i++)
+        item_bytes += d_input_signature->sizeof_stream_item(i);
+
+    std::set<es_sink_window> windows;
+    uint64_t need = d_inflight_bytes;
+    for(size_t k=0; k<d_ready.size(); k++){
+        es_eh_pair* eh = d_ready[k];
+        if(eh->stream || zero_copy_pair(eh) || inline_type(eh->event.type_id()))
+            continue;
+        if(!windows.insert(es_sink_window(eh->time(), eh->length())).second)
+            continue;
+        uint64_t nbytes = item_bytes*eh->length();
+        if(need > 0 && need + nbytes > budget)
+            return k;
+        need += nbytes;
     }
+    return d_ready.size();
+}
+
+// a charge no pair holds yet, it counts against the budget from the
+// first dispatch of a pair holding it
+es_eh_charge*
+es_sink::new_charge(uint64_t nbytes)
+{
+    es_eh_charge* charge = new es_eh_charge;
+    charge->nbytes = nbytes;
+    charge->refs = 0;
+    return charge;
+}
+
+// drop one holder of a charge, the last one gives the bytes back
+void
+es_sink::release_charge(es_eh_charge* charge)
+{
+    if(charge == NULL || --charge->refs > 0)
+        return;
+    d_inflight_bytes -= charge->nbytes;
+    delete charge;
 }
 
 int
@@ -510,48 +1008,91 @@ es_sink::work (int noutput_items,
 			gr_vector_const_void_star &input_items,
 			gr_vector_void_star &output_items)
 {
+  //printf("entered es_sink::work()\n");
+  // compute the min and max sample times currently accessible in the buffer
+  unsigned long long max_time = d_time + noutput_items;
+  unsigned long long min_time = (d_history > d_time)?0:d_time-d_history+1;
+
+  // with an external ring events may start as far back as the ring reaches
+  d_gr_min_time = min_time;
+  if(!d_rings.empty()){
+    ring_append(input_items, max_time);
+    min_time = std::min((uint64_t)min_time, d_rings[0]->start());
+  }
+
   // keep up with the latest tags
   bool end_of_file(false);
   std::vector <gr::tag_t> v;
-  get_tags_in_range(v,0,nitems_read(0),nitems_read(0)+noutput_items);
-  for(int i=0; i<v.size(); i++){
-    latest_tags = pmt::dict_add(latest_tags, v[i].key, pmt::cons(pmt::from_uint64(v[i].offset), v[i].value));
+  for(size_t i=0; i<input_items.size(); i++){
+    std::vector <gr::tag_t> vi;
+    get_tags_in_range(vi,i,nitems_read(i),nitems_read(i)+noutput_items);
+    v.insert(v.end(), vi.begin(), vi.end());
+  }
+  for(size_t i=0; i<v.size(); i++){
     if (pmt::eqv(pmt::mp("file_end"), v[i].key)) {
       end_of_file = true; // at the end of work(), wait until all events are done.
     }
   }
-
-  char *in = (char*) input_items[0];
-
-  //printf("entered es_sink::work()\n");
-  // compute the min and max sample times currently accessible in the buffer
-  unsigned long long max_time = d_time + noutput_items;
-  unsigned long long min_time = (d_history > d_time)?0:d_time-d_history+1;
+  index_tags(v, nitems_read(0)+noutput_items, min_time);
 
   d_buffer_window_size = max_time - min_time;
 
   // generate an empty event sptr
   es_eh_pair *eh = NULL;
 
-  unsigned long long delete_index = 0;
+  es_eh_done done;
 
-  //while( dq.pop(&delete_index) ){
-  while( dq.pop(delete_index) ){
-//    printf(" removing live_time %llu \n", delete_index);
+  while( dq.pop(done) ){
+//    printf(" removing live_time %llu \n", done.time);
+    release_charge(done.charge);
+    if(!done.pinned)
+        continue;
 	// remove the event time from the event live times l
-    for(int i=0; i<live_event_times.size(); i++){
-        if(live_event_times[i] == delete_index){
-            live_event_times.erase(live_event_times.begin()+i);
-            break;
-            }
+    std::map<uint64_t,int>::iterator live = live_event_times.find(done.time);
+    if(live != live_event_times.end() && --live->second == 0){
+        live_event_times.erase(live);
         }
     //assert(0);
     }
 
+  // with a memory budget events own their buffer copies and do not hold
+  // the stream, new events wait in the queue while over budget instead
+  uint64_t budget = d_memory_budget;
+  bool pin_stream = (budget == 0);
+  // read once, spans are only planned if every event below may use them
+  bool coalesce = d_coalesce;
+
+  if(d_type_flags_changed){
+    boost::mutex::scoped_lock lock(d_type_flags_lock);
+    d_zero_copy_work = d_zero_copy;
+    d_inline_work = d_inline;
+    d_type_flags_changed = false;
+  }
 
   // while we can service events with the current buffer, get them and handle them.
-//  printf("event_queue->fetch_next_event( %llu, %llu, &eh )\n", min_time, max_time );
-  while( event_queue->fetch_next_event( min_time, max_time, &eh ) ){
+//  printf("event_queue->fetch_ready_events( %llu, %llu )\n", min_time, max_time );
+
+  d_ready.clear();
+  if(pin_stream || d_inflight_bytes < budget)
+    event_queue->fetch_ready_events( min_time, max_time, d_ready );
+
+  // over budget the rest of the batch goes back to the queue, which then
+  // holds the stream at its first event
+  size_t ndispatch = pin_stream ? d_ready.size() : admit_events(input_items.size(), budget);
+  if(ndispatch < d_ready.size()){
+    event_queue->requeue_events(d_ready, ndispatch);
+    d_ready.resize(ndispatch);
+  }
+  if(coalesce)
+    plan_spans(input_items);
+  for(size_t k=0; k<d_ready.size(); k++){
+    eh = d_ready[k];
+
+    // streaming handlers are fed inline as samples arrive
+    if(eh->stream){
+        begin_stream(eh);
+        continue;
+    }
 
    DEBUG( printf("es::sink work() got event\n"); )
   //  int a = d_nevents;
@@ -559,54 +1100,117 @@ es_sink::work (int noutput_items,
     d_nevents++;
 
 //    printf("es_sink::work()::fetched event successfully (%llu --> %llu)\n",min_time,max_time);
-    pmt_t event = eh->event;
-    uint64_t etime = ::event_time(eh->event);
+    uint64_t etime = eh->time();
 
     // compute the local buffer offset of the event
     int buffer_offset = (int)(etime - d_time + d_history - 1);
+    uint64_t src_time = etime;
 
     //printf("event(%lu), time(%lu), history(%lu), offset(%d)\n",
     //        etime, d_time, d_history, buffer_offset);
-    if(buffer_offset < 0) {
+    if(buffer_offset < 0 && d_rings.empty()) {
         printf("WARNING: bad buffer_offset: %d, Dropping Data!\n",buffer_offset);
-        buffer_offset = 0;
+        src_time = d_gr_min_time;
     }
 
+    // events read out of the external ring are copied and never pin
+    bool in_stream = src_time >= d_gr_min_time;
     pmt_t buf_list = PMT_NIL;
-    bool first_item = true;
+    uint64_t nbytes = 0;
+    pmt_t buf_owner = PMT_NIL;
+    bool zero_copy = zero_copy_pair(eh);
+    bool pinned = (in_stream && pin_stream) || zero_copy;
+
+    // handlers fanned out from one event share a single read-only copy,
+    // its bytes are charged once for as long as any of them holds it
+    es_sink_window window(etime, eh->length());
+    std::map<es_sink_window, es_sink_window_buf>::iterator shared =
+        zero_copy ? d_window_bufs.end() : d_window_bufs.find(window);
+    es_sink_window_buf *copy = (shared == d_window_bufs.end()) ? NULL : &shared->second;
+
+    if(!copy && coalesce && d_span_of[k] >= 0){
+        es_sink_span &span = d_spans[d_span_of[k]];
+        copy = &span.copy;
+        if(!span.single){
+            // offset views into the span copy, which the event keeps alive
+            for(size_t i=0; i<input_items.size(); i++){
+                size_t span_len = 0;
+                uint8_t* base = pmt::u8vector_writable_elements(pmt::nth(i, span.copy.buf), span_len);
+                buf_list = pmt::list_add(buf_list, pmt::make_any( (void*)(base + (etime - span.start)*d_input_signature->sizeof_stream_item(i)) ));
+            }
+            buf_owner = span.copy.buf;
+        }
+    }
 
     // loop over each input buffer copying contents into pmt_buffers to tag onto event
-    for(int i=0; i<input_items.size(); i++){
-
-        //printf("copying buffer contents\n");
-        // alocate a new pmt u8 vector to store buffer contents in.
-        pmt_t buf_i = pmt::init_u8vector( d_input_signature->sizeof_stream_item(i)*eh->length(), (const uint8_t*) input_items[i] + (buffer_offset * d_input_signature->sizeof_stream_item(i)) );
+    for(size_t i=0; !copy && i<input_items.size(); i++){
+        const uint8_t* start = item_ptr(i, src_time, input_items);
+        pmt_t buf_i;
+
+        if(zero_copy){
+            // view into the input buffer, valid while the event pins the stream
+            buf_i = pmt::make_any( (void*) start );
+        } else {
+            //printf("copying buffer contents\n");
+            // alocate a new pmt u8 vector to store buffer contents in.
+            buf_i = pmt::init_u8vector( d_input_signature->sizeof_stream_item(i)*eh->length(), start );
+            nbytes += d_input_signature->sizeof_stream_item(i)*eh->length();
+        }
 
         // build up a pmt list containing pmt_u8vectors with all the buffers
         buf_list = pmt::list_add(buf_list, buf_i);
     }
 
+    if(copy){
+        if(pmt::is_null(buf_owner))
+            buf_list = copy->buf;
+    } else if(!zero_copy){
+        es_sink_window_buf wb = { buf_list, new_charge(nbytes) };
+        copy = &d_window_bufs.insert(std::make_pair(window, wb)).first->second;
+    }
+    es_eh_charge* charge = copy ? copy->charge : NULL;
+
     // register the buffer in the event
     DEBUG(printf("reg buffer: ");)
     DEBUG(pmt::print(buf_list);)
     DEBUG(printf("\n");)
-    event = pmt::make_tuple( es::type_es_event, pmt::dict_update( pmt::tuple_ref( event, 1), latest_tags ) );
-    event = register_buffer( event, buf_list );
-    eh->event = event;
+    // tags are only merged into the event dict if a handler asks for the pmt
+    eh->event.merge_args( tags_in(etime, etime + eh->length()) );
+    eh->event.set_buffer( buf_list, buf_owner );
+    eh->charge = charge;
+    eh->pinned = pinned;
+
+    // inline handlers are done before we go on, so their buffers never
+    // hold the stream or count against the memory budget
+    if(inline_type(eh->event.type_id())){
+        d_num_running_handlers++;
+        eh->run();
+        d_num_running_handlers--;
+        --d_nevents;
+        delete eh;
+        continue;
+    }
 
     // post the event to the event-loop input queue
     //printf("es_sink::work()::posting event to event loop queue (qq) with buffer.\n");
 
-    bool push_succeeded = qq.push(eh);
+    // the copy was just made on whatever node we run on now
+    int lane = d_localize ? local_lane() : order_lane(eh->event);
+    uint64_t deadline = eh->event.has_arg(es::event_deadline) ?
+        pmt::to_uint64(eh->event.arg(es::event_deadline)) : etime;
+    bool push_succeeded = qq.push(eh, lane, deadline);
     if (!push_succeeded) {
       switch (d_congestion_behavior){
         case BLOCK: {
-          // Timed wait and try again:
-          while (!push_succeeded) {
-            boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
-            push_succeeded = qq.push(eh);
-          }
-          break;
+          // a full queue is as saturated as the pool gets, grow it before
+          // parking since work() will not reach autoscale() meanwhile
+          if(!d_executor && d_max_threads > d_pool.min_threads)
+            autoscale(true);
+          // park until a handler thread takes an event off the queue
+          push_succeeded = qq.push_wait(eh, lane, deadline);
+          if (push_succeeded)
+            break;
+          // the queue was closed under us, drop the event
         }
         case DROP:
         default: {
@@ -616,34 +1220,55 @@ es_sink::work (int noutput_items,
           break;
         }
       }
+      // a dropped event never reports completion, so it must not pin the buffer
+      if(!push_succeeded)
+        continue;
     }
 
-    // insert event time in an ordered list of live events
-    int live_event_times_insert_offset = find_index(etime);
-    live_event_times.insert(live_event_times.begin() + live_event_times_insert_offset, etime);
-//    printf("adding live event time %lu\n", ::event_time(eh->event));
+    if(d_executor)
+        d_executor->notify();
 
-    qq_cond.notify_one();
+    // insert event time in an ordered list of live events,
+    // eh belongs to the event loop threads from here on
+    if(charge && charge->refs++ == 0)
+        d_inflight_bytes += charge->nbytes;
+    if(pinned)
+        live_event_times[etime]++;
+//    printf("adding live event time %lu\n", ::event_time(eh->event));
 
   }
+  // copies only inline or dropped pairs used were never charged
+  for(std::map<es_sink_window, es_sink_window_buf>::iterator it = d_window_bufs.begin(); it != d_window_bufs.end(); it++){
+    if(it->second.charge->refs == 0)
+        delete it->second.charge;
+  }
+  for(size_t s=0; s<d_spans.size(); s++){
+    if(d_spans[s].copy.charge->refs == 0)
+        delete d_spans[s].copy.charge;
+  }
+  d_window_bufs.clear();
+  d_spans.clear();
+  service_streams(input_items, max_time, end_of_file);
 
-  // consume the current input items
+  if(!d_executor && d_max_threads > d_pool.min_threads)
+    autoscale();
+
+  // consume the current input items, pending events (including those put
+  // back over budget) only hold the stream while their start is not
+  // covered by an external ring
+  uint64_t queue_min = event_queue->empty() ? 0 : event_queue->min_time();
   int nconsume = (int)std::min(
                     (uint64_t)noutput_items,
                     std::min(
-                        live_event_times.size()==0?
+                        live_event_times.empty()?
                             noutput_items :
-                            (uint64_t)(live_event_times[0] - min_time),
-                        event_queue->empty()?
+                            (uint64_t)(live_event_times.begin()->first - d_gr_min_time),
+                        (event_queue->empty() || !d_rings.empty() || queue_min < d_gr_min_time)?
                             noutput_items :
-                            (uint64_t)(event_queue->min_time() - min_time)
+                            (uint64_t)(queue_min - d_gr_min_time)
                         )
                     );
 
-  // make sure worker threads are working on live events
-  if(nconsume != noutput_items)
-    qq_cond.notify_one();
-
   // if we can not consume any more while waiting for the next event - yield so handler can finish
   if(nconsume == 0)
 	boost::this_thread::yield();
@@ -660,13 +1285,11 @@ es_sink::work (int noutput_items,
   return nconsume;
 }
 
-void es_sink::wait_events(){
-    // wait for all events to get picked up by threads
-    while(d_nevents>0){
-        // we need to allow our python flowgraph handlers to be able to grab the GIL here...
-        qq_cond.notify_all();
-        //Py_BEGIN_ALLOW_THREADS
-        boost::this_thread::yield();
-        //Py_END_ALLOW_THREADS
-        }
+bool es_sink::wait_events(int timeout_ms){
+    // wait for all events to get picked up by threads, the handler
+    // finishing the last one wakes us
+    // we need to allow our python flowgraph handlers to be able to grab the GIL here...
+    //Py_BEGIN_ALLOW_THREADS
+    return d_nevents.wait_zero(timeout_ms);
+    //Py_END_ALLOW_THREADS
 }
@@ -34,6 +34,7 @@
 #include <es/es_queue.h>
 #include <es/es.h>
 #include <es/es_handler_insert_vector.h>
+#include <es/es_affinity.h>
 #include <gnuradio/io_signature.h>
 #include <boost/format.hpp>
 #include <stdio.h>
@@ -48,9 +49,9 @@
  * a boost shared_ptr.  This is effectively the public constructor.
  */
 es_source_sptr 
-es_make_source (gr_vector_int out_sig, int nthreads, enum es_queue_early_behaviors eb)
+es_make_source (gr_vector_int out_sig, int nthreads, enum es_queue_early_behaviors eb, enum es_scheduling_policies sp, int queue_capacity)
 {
-  return es_source_sptr (new es_source (out_sig, nthreads, eb));
+  return es_source_sptr (new es_source (out_sig, nthreads, eb, sp, queue_capacity));
 }
 
 /*
@@ -72,19 +73,23 @@ unsigned long long es_source::time(){
 /*
  * The private constructor
  */
-es_source::es_source (gr_vector_int out_sig, int nthreads, enum es_queue_early_behaviors eb)
+es_source::es_source (gr_vector_int out_sig, int nthreads, enum es_queue_early_behaviors eb, enum es_scheduling_policies sp, int queue_capacity)
   : gr::sync_block ("es_source",
         gr::io_signature::make (MIN_IN, MAX_IN, 0),
         es_make_io_signature (out_sig.size(), out_sig) ),
-    d_maxlen(ULLONG_MAX),
-    d_time(0),
+    es_event_acceptor(eb),
+    qq(queue_capacity),
     n_threads(nthreads), // poke this through as a constructor arg
-    qq(100), dq(100),
-    es_event_acceptor(eb)
+    d_out_sig(out_sig),
+    d_maxlen(ULLONG_MAX),
+    d_time(0)
 {
+    if(queue_capacity <= 0)
+        throw std::runtime_error("es_source: queue_capacity must be at least 1");
     // create and dispatch handler threads
+    qq.set_policy(sp, n_threads);
     for(int i=0; i<n_threads; i++){
-        boost::shared_ptr<es_source_thread> th( new es_source_thread(pmt::PMT_NIL, event_queue, &qq, &lin_mut, &readylist, &qq_cond, out_sig) );
+        boost::shared_ptr<es_source_thread> th( new es_source_thread(pmt::PMT_NIL, event_queue, &qq, &lin_mut, &readylist, out_sig, i) );
         threadpool.push_back( th );
     }
 
@@ -109,10 +114,19 @@ bool es_source::cb(es_eh_pair** eh){
     
     DEBUG(printf("es_source::cb() executing.\n");)
 
-    // pass eh pair to lockfree fifos (out to threads)
     es_eh_pair * tp = *eh;
-    qq.push(tp);
-    qq_cond.notify_one(); // notify one of the sleeping threads (if any)
+    if(inline_type(tp->event.type_id())){
+        // run it right away on the caller's thread
+        if(!d_zerobuf.get())
+            d_zerobuf.reset(new std::vector<char>());
+        es_source_thread::run_pair(tp, d_out_sig, *d_zerobuf, &lin_mut, &readylist);
+        return false;
+    }
+
+    // pass eh pair to lockfree fifos (out to threads)
+    qq.push(tp, -1, tp->time());  // wakes one of the sleeping threads (if any)
+    if(d_executor)
+        d_executor->notify();
     
     // we dont need this event anymore in the main queue
     return false;
@@ -124,14 +138,70 @@ void es_source::set_max(unsigned long long maxlen){
     d_maxlen = maxlen;
 }
 
+void es_source::set_executor(es_executor_sptr executor, int weight){
+    if(!executor)
+        throw std::runtime_error("es_source::set_executor: no executor given");
+    if(d_executor)
+        d_executor->detach(this);
+
+    // attach before retiring our own threads so nothing queued meanwhile
+    // is left without a consumer, they drain what they can see first
+    executor->attach(this, weight);
+    d_executor = executor;
+    for(size_t i=0; i<threadpool.size(); i++){
+        threadpool[i]->stop();
+    }
+    threadpool.clear();
+    qq.open();
+}
+
+void es_source::set_thread_affinity(std::vector<int> cpus){
+    for(size_t i=0; !cpus.empty() && i<threadpool.size(); i++){
+        threadpool[i]->set_affinity(es_node_cpus(cpus, cpus[i % cpus.size()]));
+    }
+}
+
+void es_source::set_inline(std::string type, bool enable){
+    int type_id = es_event_type_id(pmt::intern(type));
+    boost::mutex::scoped_lock lock(d_inline_lock);
+    if((size_t)type_id >= d_inline.size())
+        d_inline.resize(type_id+1, false);
+    d_inline[type_id] = enable;
+}
+
+bool es_source::inline_type(int type_id){
+    if(n_threads == 0 && !d_executor)
+        return true;
+    boost::mutex::scoped_lock lock(d_inline_lock);
+    return type_id >= 0 && (size_t)type_id < d_inline.size() && d_inline[type_id];
+}
+
+// called by the shared executor's workers
+bool es_source::run_one(){
+    es_eh_pair* eh = NULL;
+    bool found = qq.pop(eh);
+    // keyed lanes are never stolen from, look in each of them
+    for(int l=1; !found && l<qq.nlanes(); l++)
+        found = qq.pop(eh, l);
+    if(!found)
+        return false;
+    if(!d_zerobuf.get())
+        d_zerobuf.reset(new std::vector<char>());
+    es_source_thread::run_pair(eh, d_out_sig, *d_zerobuf, &lin_mut, &readylist);
+    return true;
+}
+
 /*
  * Our virtual destructor.
  */
 es_source::~es_source ()
 {
+    if(d_executor)
+        d_executor->detach(this);
+
     // TODO: move this to stop() instead?
     //shutdown threads
-    for(int i=0; i<n_threads; i++){
+    for(size_t i=0; i<threadpool.size(); i++){
         threadpool[i]->stop();
     }
 }
@@ -141,16 +211,12 @@ es_source::work (int noutput_items,
 			gr_vector_const_void_star &input_items,
 			gr_vector_void_star &output_items)
 {
-  char *out = (char *) output_items[0];
   DEBUG(printf("entered work.\n");)
   DEBUG(printf("d_time = %llu, noutput_items = %d\n", d_time, noutput_items);  )
   
 
-  unsigned long long max_time = d_time + noutput_items;
-  unsigned long long min_time = d_time;
-
   // zero the output buffers
-  for(int j=0; j<output_items.size();j++){
+  for(size_t j=0; j<output_items.size();j++){
       int itemsize = d_output_signature->sizeof_stream_item(j);
       memset(output_items[j], 0x00, noutput_items*itemsize);
   }
@@ -160,15 +226,13 @@ es_source::work (int noutput_items,
 
   // grab serialized buffers from thread output
   //        copy buffers into work output buffer
-  std::vector<pmt_t>::iterator it;
-  for(int i = 0; i<readylist.size(); i++){
-    DEBUG(printf("readylist[%d] = %p\n", i, readylist[i].get());)
-    pmt_t evt = readylist[i];
+  for(size_t i = 0; i<readylist.size(); i++){
+    es_event evt = readylist[i];
 //    std::cout << "iterating over ready list (i=" << i << ", evt_time = "<<event_time(evt)<<")\n";
 //    std::cout << " got reference ("<<event_time(evt)<<","<<event_length(evt),")\n";
     
-    uint64_t e_time = event_time(evt);
-    uint64_t e_length = event_length(evt);
+    uint64_t e_time = evt.time();
+    uint64_t e_length = evt.length();
     
 
     if(e_time >= d_time + noutput_items){ // event starts after our current buffer area save for later
@@ -192,8 +256,8 @@ es_source::work (int noutput_items,
                 case ASAP:
                     // update event time to be as soon as possible
                     //printf("ADDING TIME TO EVT!! %lu\n", d_time);
-                    evt = event_args_add(evt, pmt::intern("es::event_time") , pmt::from_uint64(d_time));
-                    e_time = event_time(evt);
+                    evt.set_time(d_time);
+                    e_time = evt.time();
                     //printf("updating event time.\n");
                     break;
                 default:
@@ -205,7 +269,7 @@ es_source::work (int noutput_items,
         // if we reach this point, we will be generating output from this event
         // compute portion of event to output
         int space_avail = d_time + noutput_items - e_time;
-        int item_copy = (space_avail >= e_length ? e_length : space_avail); //TODO: this may cause issues for large events
+        int item_copy = ((uint64_t)space_avail >= e_length ? e_length : space_avail); //TODO: this may cause issues for large events
 
         // compute copy offsets
         int output_offset = 0;
@@ -227,13 +291,13 @@ es_source::work (int noutput_items,
         // (*it) == event
         // TODO: error checking on this ?
         DEBUG(printf("making sure buffer list arg exists\n");)
-        if( !event_has_field( (evt), es::event_buffer ) ){
+        if( pmt::eq( evt.buffer(), PMT_NIL ) ){
             perror("malformed event");
             }
         DEBUG(printf("getting buffer list element\n");)
 
         // buf_list is a pmt_list of pmt_blobs containing buffers for N output ports
-        pmt_t buf_list = event_field( (evt), es::event_buffer ); 
+        pmt_t buf_list = evt.buffer();
         //printf("buf has %d elements.\n", pmt_length(buf_list) );
 
         // sanity checking
@@ -242,7 +306,7 @@ es_source::work (int noutput_items,
         }
 
         // copy to output buffer (iterate over number of output ports)
-        for(int j=0; j<output_items.size();j++){
+        for(size_t j=0; j<output_items.size();j++){
             DEBUG(printf("getting %d'th buffer\n", j);)
             pmt_t buf = pmt::nth(j, buf_list);           
 
@@ -268,18 +332,18 @@ es_source::work (int noutput_items,
 //        std::cout << "e_length = " << e_length << ", item_copy = " << item_copy << "\n";
 
         // if we have leftovers to store (from previous work executions)
-        if(e_length > item_copy){
+        if(e_length > (uint64_t)item_copy){
 
             DEBUG(printf("generating continuation event for next time.\n");)
 
             // generate a new event to represent the remaining contents which have not yet been output
-            pmt_t evt_c = event_create( "CONTINUATION", e_time + item_copy, e_length - item_copy );
+            es_event evt_c( pmt::intern("CONTINUATION"), e_time + item_copy, e_length - item_copy );
             pmt_t outbuf_list = pmt::PMT_NIL;
 
             // populate the event with remaining buffer contents
             // create a pmt_list with pointers to existing buffers
             // no new mallocing should happen here
-            for(int j=0; j<output_items.size();j++){ //iterate over number of output ports
+            for(size_t j=0; j<output_items.size();j++){ //iterate over number of output ports
                 int itemsize = d_output_signature->sizeof_stream_item(j);
 
                 // get a reference to our blob of interest in the blob list
@@ -287,30 +351,29 @@ es_source::work (int noutput_items,
                 const char* base_srcptr = (const char*) pmt::blob_data(buf);
 
                 // make a new blob pointing to a portion of the old blob
-                pmt_t newblob = pmt::make_blob( base_srcptr + itemsize * item_copy, itemsize*(event_length(evt)-item_copy));
+                pmt_t newblob = pmt::make_blob( base_srcptr + itemsize * item_copy, itemsize*(e_length-item_copy));
                 outbuf_list = pmt::list_add( outbuf_list, newblob );
             }
  
             // tag the new buffers onto the event
             DEBUG(printf("register buffer.\n");)
-            evt_c = register_buffer( evt_c, outbuf_list );
+            evt_c.set_buffer( outbuf_list );
 
             // the original buffers are saved to make sure we reserve the pmt_blobs allocation!           
             static const pmt_t ORIG_FLAG(pmt::intern("SAVE_ORIG_BUFS"));
-            if(event_has_field(evt, ORIG_FLAG)){
-                evt_c = event_args_add( evt_c, ORIG_FLAG, event_field( evt, ORIG_FLAG ) );
+            if(evt.has_arg(ORIG_FLAG)){
+                evt_c.add_arg( ORIG_FLAG, evt.arg(ORIG_FLAG) );
             } else {
-                evt_c = event_args_add( evt_c, ORIG_FLAG, event_field( evt, es::event_buffer ) );
+                evt_c.add_arg( ORIG_FLAG, evt.buffer() );
             }
  
             DEBUG(printf("inserting into readylist (readylist.size() = %lu).\n",readylist.size());)
             // insert the new event into our readylist
-            for(int k=0; k<=readylist.size(); k++){
+            for(size_t k=0; k<=readylist.size(); k++){
                 if(k == readylist.size()){
                     readylist.insert( readylist.begin()+k, evt_c );
-//                    std::cout << "inserting into end of readylist (" <<  event_time(evt_c) << ", " << event_length(evt_c) << ")\n";
                     break;
-                } else if( event_time(evt_c) < event_time(readylist[k]) ){
+                } else if( evt_c.time() < readylist[k].time() ){
                     readylist.insert( readylist.begin()+k, evt_c );
                     DEBUG(printf("inserting into %d of readylist.\n",k);)
                     break;
@@ -23,21 +23,24 @@
 #include <stdio.h>
 #include <es/es_common.h>
 #include <es/es_source_thread.hh>
+#include <es/es_affinity.h>
 
 
 /*
  * Constructor function, sets up parameters
  */
 //es_source_thread::es_source_thread(pmt_t _arb, es_queue_sptr _queue, boost::lockfree::queue<es_eh_pair*> *_qq, boost::lockfree::queue<unsigned long long> *_dq, boost::condition *_qq_cond) :
-es_source_thread::es_source_thread(pmt_t _arb, es_queue_sptr _queue, boost::lockfree::queue<es_eh_pair*> *_qq, boost::mutex *_lin_mut, std::vector<pmt_t> *_readylist, boost::condition *_qq_cond, gr_vector_int _out_sig) :
+es_source_thread::es_source_thread(pmt_t _arb, es_queue_sptr _queue, es_work_queue<es_eh_pair*> *_qq, boost::mutex *_lin_mut, std::vector<es_event> *_readylist, gr_vector_int _out_sig, int lane) :
     arb(_arb),
     queue(_queue),
-    qq(_qq),
-    qq_cond(_qq_cond),
-    readylist(_readylist),
-    lin_mut(_lin_mut),
     finished(false),
-    out_sig(_out_sig) // TODO: update out_sig when connections are updated ??
+    out_sig(_out_sig), // TODO: update out_sig when connections are updated ??
+    lin_mut(_lin_mut),
+    readylist(_readylist),
+    qq(_qq),
+    d_lane(lane),
+    d_cpus_gen(0),
+    d_pinned_gen(0)
 {
     start();
 }
@@ -55,11 +58,17 @@ void es_source_thread::start(){
  */
 void es_source_thread::stop(){
     finished = true;
-    qq_cond->notify_all();
+    qq->close();
     d_thread->join();
 }
 
 
+void es_source_thread::set_affinity(const std::vector<int> &cpus){
+    boost::mutex::scoped_lock lock(d_cpus_lock);
+    d_cpus = cpus;
+    d_cpus_gen++;
+}
+
 /*
  *  Main event loop thread work function,
  *    constantly receives and services event/handler pairs
@@ -67,72 +76,78 @@ void es_source_thread::stop(){
  */
 void es_source_thread::do_work(){
 
-    // used by boost::condition, has no scope outside of this thread, unneccisary
-    boost::mutex access;
-    boost::mutex::scoped_lock lock(access);
-
-    // run the thread until we are told to shut down
-    while(!finished){
-        es_eh_pair* eh = NULL;
-
-        // wait for a signal to start looking in the queue (when we run out of events)
-        qq_cond->wait(lock);
-
-        // get events to handle as long as they are available
-        while( (*qq).pop(eh) ){
+    es_eh_pair* eh = NULL;
+
+    // run the thread until the work queue is closed and drained,
+    // wait_pop() parks us until an event is posted
+    while( qq->wait_pop(eh, d_lane) ){
+        // pin before running anything and drop the output buffer, so it
+        // is allocated again on the new node
+        int gen = d_cpus_gen;
+        if(gen != d_pinned_gen){
+            std::vector<int> cpus;
+            {
+                boost::mutex::scoped_lock lock(d_cpus_lock);
+                cpus = d_cpus;
+            }
+            es_set_thread_affinity(cpus);
+            d_pinned_gen = gen;
+            std::vector<char>().swap(zerobuf);
+        }
+        run_pair(eh, out_sig, zerobuf, lin_mut, readylist);
+    }
+}
 
-            // if BB entered, we have a new eh pair to process ... 
-            
-            // TODO: replace this segment with pmt_mgr managed pmt_blobs!!
-            //          round up to next 2^n size for better pool size hits
-            // allocate some buffers (this should be pooled soon)
-            int n_items = event_length(eh->event);
+void es_source_thread::run_pair(es_eh_pair* eh, gr_vector_int &out_sig,
+    std::vector<char> &zerobuf, boost::mutex *lin_mut,
+    std::vector<es_event> *readylist)
+{
+    // TODO: replace this segment with pmt_mgr managed pmt_blobs!!
+    //          round up to next 2^n size for better pool size hits
+    // allocate some buffers (this should be pooled soon)
+    int n_items = eh->length();
 
 
-            pmt_t buf_list;
-            for(int i=0 ; i<out_sig.size(); i++){
-                int itemsize = out_sig[i];
+    pmt_t buf_list;
+    for(size_t i=0 ; i<out_sig.size(); i++){
+        int itemsize = out_sig[i];
 
 //                printf("allocating buffer idx = %d, itemsize = %d, n_items = %d\n", i, itemsize, n_items);
-                
-                if(zerobuf.size() < itemsize*n_items){
-                    zerobuf.resize(itemsize*n_items);
-                }
-                pmt_t buf = pmt::make_blob(&zerobuf[0],itemsize*n_items);
-
-                if(i==0){
-                    buf_list = pmt::list1( buf );
-                } else {
-                    buf_list = pmt::list_add( buf_list, buf );
-                }
+        
+        if(zerobuf.size() < (size_t)(itemsize*n_items)){
+            zerobuf.resize(itemsize*n_items);
+        }
+        pmt_t buf = pmt::make_blob(&zerobuf[0],itemsize*n_items);
 
-            }
-    
-            // assign buffers to the event for output
-            pmt_t event = register_buffer( eh->event, buf_list);
-            eh->event = event;
+        if(i==0){
+            buf_list = pmt::list1( buf );
+        } else {
+            buf_list = pmt::list_add( buf_list, buf );
+        }
 
-            // run the event/handler pair
-            eh->run();
+    }
 
-            // grab the mutex over the linear list 
-            lin_mut->lock();
-            //printf("got lock\n");
+    // assign buffers to the event for output
+    eh->event.set_buffer( buf_list );
 
-            // add buffer into re time ordered list of events
-            readylist->push_back( eh->event );
-                // source2::work() can not grab the earliest event off this list and memcpy away
+    // run the event/handler pair
+    eh->run();
 
-            // release mutex lock
-            lin_mut->unlock();
-            //printf("released lock\n");
+    // grab the mutex over the linear list 
+    lin_mut->lock();
+    //printf("got lock\n");
 
-            // disabled for now, we need to worry about cleaning up leaks later ...
-            // delete the pair, (the event should be ref counted underneath and uneffected)
-            //delete eh;
+    // add buffer into re time ordered list of events
+    readylist->push_back( eh->event );
+        // source2::work() can not grab the earliest event off this list and memcpy away
 
-        }
-    }
+    // release mutex lock
+    lin_mut->unlock();
+    //printf("released lock\n");
+
+    // the readylist holds its own copy of the event and the
+    // append callback keeps the pair out of the queue, so we own it
+    delete eh;
 }
 
 
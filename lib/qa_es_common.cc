@@ -26,6 +26,20 @@
 #include <stdio.h>
 #include <es/es.h>
 
+// minimal streaming handler, records what it was given
+class qa_stream_handler : public es_handler, public es_stream_handler {
+    public:
+        qa_stream_handler() :
+            gr::sync_block("qa_stream_handler",
+                gr::io_signature::make(0,0,0),
+                gr::io_signature::make(0,0,0)),
+            nbegin(0), nitems(0), nend(0) {}
+        void stream_begin(es_event &evt){ nbegin++; }
+        void stream_chunk(es_event &evt, uint64_t offset, gr_vector_const_void_star &buf, int n){ nitems += n; }
+        void stream_end(es_event &evt){ nend++; }
+        int nbegin, nitems, nend;
+};
+
 // Test event generation, queue insertion, handler binding, general non gr-runtime operation
 void 
 qa_es_common::t1()
@@ -56,9 +70,490 @@ qa_es_common::t1()
     q->add_event(evt2);
     q->add_event(evt3);
 
+    // unregistered types are refused by the producer, types without a
+    // handler are dropped there as well
+    CPPUNIT_ASSERT_EQUAL( -1, q->add_event( event_create( "unknown_evt", 300, 10 ) ) );
+    q->register_event_type( "unbound_evt" );
+    CPPUNIT_ASSERT_EQUAL( 0, q->add_event( event_create( "unbound_evt", 300, 10 ) ) );
+    CPPUNIT_ASSERT_EQUAL( 3, q->length() );
+
     q->print_queue();
 
 }
 
+// Test that the heap queue backend hands events back in time order
+void
+qa_es_common::t2()
+{
+    printf("t2\n");
+    es_queue_sptr q = es_make_queue(DISCARD, SEARCH_HEAP);
+
+    q->register_event_type( "heap_evt" );
+    es_handler_sptr h1( es_make_handler_print(es_handler_print::TYPE_F32) );
+    q->bind_handler( "heap_evt", h1 );
+
+    q->add_event( event_create( "heap_evt", 50, 10 ) );
+    q->add_event( event_create( "heap_evt", 10, 10 ) );
+    q->add_event( event_create( "heap_evt", 30, 100 ) );
+    q->add_event( event_create( "heap_evt", 20, 10 ) );
+    CPPUNIT_ASSERT_EQUAL( 4, q->length() );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)10, q->min_time() );
+
+    // the event at 30 ends too late and must be skipped, not lost
+    uint64_t expected[] = { 10, 20, 50 };
+    es_eh_pair* eh = NULL;
+    for(int i=0; i<3; i++){
+        CPPUNIT_ASSERT( q->fetch_next_event( 0, 100, &eh ) );
+        CPPUNIT_ASSERT_EQUAL( expected[i], (uint64_t)eh->time() );
+        delete eh;
+    }
+    CPPUNIT_ASSERT( !q->fetch_next_event( 0, 100, &eh ) );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)30, q->min_time() );
+
+    CPPUNIT_ASSERT( q->fetch_next_event( 0, 200, &eh ) );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)30, (uint64_t)eh->time() );
+    delete eh;
+    CPPUNIT_ASSERT( q->empty() );
+}
+
+// Test that a batch fetch drains every fitting event in order on both backends
+void
+qa_es_common::t3()
+{
+    printf("t3\n");
+    es_search_behaviors modes[] = { SEARCH_BINARY, SEARCH_HEAP };
+    for(int m=0; m<2; m++){
+        es_queue_sptr q = es_make_queue(ASAP, modes[m]);
+
+        q->register_event_type( "batch_evt" );
+        es_handler_sptr h1( es_make_handler_print(es_handler_print::TYPE_F32) );
+        q->bind_handler( "batch_evt", h1 );
+
+        q->add_event( event_create( "batch_evt", 50, 10 ) );
+        q->add_event( event_create( "batch_evt", 5, 10 ) );
+        q->add_event( event_create( "batch_evt", 30, 100 ) );
+        q->add_event( event_create( "batch_evt", 20, 10 ) );
+        q->add_event( event_create( "batch_evt", 150, 10 ) );
+
+        // the early event at 5 is moved up to 15, 30 ends too late
+        std::vector<es_eh_pair*> out;
+        CPPUNIT_ASSERT_EQUAL( 3, q->fetch_ready_events( 15, 100, out ) );
+        uint64_t expected[] = { 15, 20, 50 };
+        for(int i=0; i<3; i++){
+            CPPUNIT_ASSERT_EQUAL( expected[i], (uint64_t)out[i]->time() );
+            delete out[i];
+        }
+        CPPUNIT_ASSERT_EQUAL( 2, q->length() );
+        CPPUNIT_ASSERT_EQUAL( (uint64_t)30, q->min_time() );
+
+        // 30 stays pending without being lost or fetched twice
+        out.clear();
+        CPPUNIT_ASSERT_EQUAL( 0, q->fetch_ready_events( 15, 100, out ) );
+        CPPUNIT_ASSERT_EQUAL( 2, q->length() );
+        CPPUNIT_ASSERT_EQUAL( (uint64_t)30, q->min_time() );
+
+        CPPUNIT_ASSERT_EQUAL( 2, q->fetch_ready_events( 15, 200, out ) );
+        CPPUNIT_ASSERT_EQUAL( (uint64_t)30, (uint64_t)out[0]->time() );
+        CPPUNIT_ASSERT_EQUAL( (uint64_t)150, (uint64_t)out[1]->time() );
+        delete out[0];
+        delete out[1];
+        CPPUNIT_ASSERT( q->empty() );
+    }
+}
+
+// Test that freed eh pairs are recycled through the queue's pair pool
+void
+qa_es_common::t4()
+{
+    printf("t4\n");
+    es_queue_sptr q = es_make_queue(DISCARD, SEARCH_BINARY);
+
+    q->register_event_type( "pool_evt" );
+    es_handler_sptr h1( es_make_handler_print(es_handler_print::TYPE_F32) );
+    q->bind_handler( "pool_evt", h1 );
+
+    std::vector<es_eh_pair*> out;
+    for(int round=0; round<4; round++){
+        for(int i=0; i<10; i++){
+            q->add_event( event_create( "pool_evt", 10*i, 5 ) );
+        }
+        out.clear();
+        CPPUNIT_ASSERT_EQUAL( 10, q->fetch_ready_events( 0, 1000, out ) );
+        for(size_t i=0; i<out.size(); i++){
+            delete out[i];
+        }
+    }
+
+    // only the first round can miss, later rounds reuse the same slots
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)1, q->pair_pool().misses() );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)39, q->pair_pool().hits() );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)10, q->pair_pool().peak() );
+
+    // pairs still queued or staged when the queue goes are destroyed,
+    // releasing whatever their events hold
+    boost::shared_ptr<int> held( new int(0) );
+    {
+        es_queue_sptr q2 = es_make_queue(DISCARD, SEARCH_BINARY);
+        q2->register_event_type( "pool_evt" );
+        q2->bind_handler( "pool_evt", h1 );
+        q2->add_event( event_args_add( event_create( "pool_evt", 10, 5 ), pmt::intern("held"), pmt::make_any(held) ) );
+        q2->min_time();     // merges the first one into event_queue
+        q2->add_event( event_args_add( event_create( "pool_evt", 20, 5 ), pmt::intern("held"), pmt::make_any(held) ) );
+        CPPUNIT_ASSERT( held.use_count() > 1 );
+    }
+    CPPUNIT_ASSERT_EQUAL( 1L, held.use_count() );
+}
+
+// Test that the double mapped ring hands back contiguous runs across the wrap
+void
+qa_es_common::t5()
+{
+    printf("t5\n");
+    es_ring_buffer r(sizeof(float), 1000);
+    CPPUNIT_ASSERT( r.capacity() >= 1000 );
+
+    std::vector<float> v(300);
+    uint64_t n = 0;
+    for(int k=0; k<20; k++){
+        for(size_t i=0; i<v.size(); i++)
+            v[i] = n + i;
+        r.push( &v[0], v.size() );
+        n += v.size();
+    }
+    CPPUNIT_ASSERT_EQUAL( n, r.end() );
+    CPPUNIT_ASSERT_EQUAL( n - r.capacity(), r.start() );
+
+    const float* p = (const float*) r.at( r.start() );
+    for(uint64_t i=0; i<r.capacity(); i++){
+        CPPUNIT_ASSERT_EQUAL( (float)(r.start() + i), p[i] );
+    }
+}
+
+// executor client counting the work items it runs
+class qa_executor_client : public es_executor_client {
+  public:
+    es_work_queue<int> q;
+    boost::atomic<int> nrun;
+    qa_executor_client() : q(64), nrun(0) {}
+    bool run_one(){
+        int item;
+        if(!q.pop(item))
+            return false;
+        nrun++;
+        return true;
+    }
+};
+
+// Test that events bound to a streaming handler are fetched once they start
+void
+qa_es_common::t6()
+{
+    printf("t6\n");
+    es_queue_sptr q = es_make_queue(DISCARD, SEARCH_BINARY);
+
+    q->register_event_type( "long_evt" );
+    es_handler_sptr h1( es_make_handler_print(es_handler_print::TYPE_F32) );
+    boost::shared_ptr<qa_stream_handler> h2( new qa_stream_handler() );
+    q->bind_handler( "long_evt", h1 );
+    q->bind_handler( "long_evt", h2 );
+
+    // far longer than the window, only the streaming pair can be fetched
+    q->add_event( event_create( "long_evt", 10, 100000 ) );
+
+    std::vector<es_eh_pair*> out;
+    CPPUNIT_ASSERT_EQUAL( 1, q->fetch_ready_events( 0, 100, out ) );
+    CPPUNIT_ASSERT( out[0]->stream == h2.get() );
+    CPPUNIT_ASSERT_EQUAL( 1, q->length() );
+    delete out[0];
+
+    // once the window covers the whole event the print pair comes out too
+    out.clear();
+    CPPUNIT_ASSERT_EQUAL( 1, q->fetch_ready_events( 0, 200000, out ) );
+    CPPUNIT_ASSERT( out[0]->stream == NULL );
+    CPPUNIT_ASSERT( q->empty() );
+    delete out[0];
+}
+
+// Test that an idle consumer steals from the other lanes before parking
+void
+qa_es_common::t7()
+{
+    printf("t7\n");
+    es_work_queue<int> q(16);
+    q.set_policy(SCHEDULE_STEAL, 4);
+    CPPUNIT_ASSERT_EQUAL( 4, q.nlanes() );
+
+    // dealt round robin, two items per lane
+    for(int i=0; i<8; i++){
+        CPPUNIT_ASSERT( q.push(i) );
+    }
+
+    // lane 0 drains its own two items then takes the other six
+    int item;
+    std::vector<int> seen(8, 0);
+    for(int i=0; i<8; i++){
+        CPPUNIT_ASSERT( q.pop(item, 0) );
+        seen[item]++;
+    }
+    CPPUNIT_ASSERT( !q.pop(item, 0) );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)6, q.steals() );
+    for(int i=0; i<8; i++){
+        CPPUNIT_ASSERT_EQUAL( 1, seen[i] );
+    }
+
+    // closed and drained, consumers are released
+    q.close();
+    CPPUNIT_ASSERT( !q.wait_pop(item, 2) );
+}
+
+// Test that one shared executor serves the work of several clients
+void
+qa_es_common::t8()
+{
+    printf("t8\n");
+    es_executor_sptr ex = es_make_executor(2);
+    CPPUNIT_ASSERT_EQUAL( 2, ex->n_threads() );
+
+    qa_executor_client c1, c2;
+    ex->attach(&c1, 1);
+    ex->attach(&c2, 4);
+    for(int i=0; i<20; i++){
+        c1.q.push(i);
+        ex->notify();
+        c2.q.push(i);
+        ex->notify();
+    }
+
+    for(int i=0; i<1000 && ex->num_run() < 40; i++){
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    }
+    ex->detach(&c1);
+    ex->detach(&c2);
+    CPPUNIT_ASSERT_EQUAL( 20, (int)c1.nrun );
+    CPPUNIT_ASSERT_EQUAL( 20, (int)c2.nrun );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)40, ex->num_run() );
+}
+
+// Test that a limited work queue refuses items once full
+void
+qa_es_common::t9()
+{
+    printf("t9\n");
+    es_work_queue<int> q(4);
+    q.set_limit(3);
+    for(int i=0; i<3; i++){
+        CPPUNIT_ASSERT( q.push(i) );
+    }
+    CPPUNIT_ASSERT( !q.push(3) );
+    CPPUNIT_ASSERT_EQUAL( (size_t)3, q.size() );
+
+    // taking one makes room for exactly one more
+    int item;
+    CPPUNIT_ASSERT( q.pop(item) );
+    CPPUNIT_ASSERT( q.push_wait(3) );
+    CPPUNIT_ASSERT( !q.push(4) );
+
+    // a full queue that is closed releases its producers
+    q.close();
+    CPPUNIT_ASSERT( !q.push_wait(4) );
+}
+
+// Test that keyed lanes keep their order and are never stolen from
+void
+qa_es_common::t10()
+{
+    printf("t10\n");
+    es_work_queue<int> q(16);
+    q.set_policy(SCHEDULE_KEYED, 3);
+    for(int i=0; i<6; i++){
+        CPPUNIT_ASSERT( q.push(i, i%2) );
+    }
+
+    int item;
+    CPPUNIT_ASSERT( !q.pop(item, 2) );
+    for(int i=1; i<6; i+=2){
+        CPPUNIT_ASSERT( q.pop(item, 1) );
+        CPPUNIT_ASSERT_EQUAL( i, item );
+    }
+    CPPUNIT_ASSERT( !q.pop(item, 1) );
+    for(int i=0; i<6; i+=2){
+        CPPUNIT_ASSERT( q.pop(item, 0) );
+        CPPUNIT_ASSERT_EQUAL( i, item );
+    }
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)0, q.steals() );
+}
+
+// Test that SCHEDULE_EDF hands out the earliest deadline first
+void
+qa_es_common::t11()
+{
+    printf("t11\n");
+    es_work_queue<int> q(16);
+    q.set_policy(SCHEDULE_EDF, 4);
+    int deadlines[] = { 50, 10, 40, 10, 30 };
+    for(int i=0; i<5; i++){
+        CPPUNIT_ASSERT( q.push(i, -1, deadlines[i]) );
+    }
+
+    // equal deadlines keep their push order
+    int expect[] = { 1, 3, 4, 2, 0 };
+    int item;
+    for(int i=0; i<5; i++){
+        CPPUNIT_ASSERT( q.pop(item, i%4) );
+        CPPUNIT_ASSERT_EQUAL( expect[i], item );
+    }
+    CPPUNIT_ASSERT( !q.pop(item) );
+}
+
+// Test that both backends count the same events as not yet complete
+void
+qa_es_common::t12()
+{
+    printf("t12\n");
+    es_search_behaviors modes[] = { SEARCH_BINARY, SEARCH_HEAP };
+    for(int m=0; m<2; m++){
+        es_queue_sptr q = es_make_queue(ASAP, modes[m]);
 
+        q->register_event_type( "soon_evt" );
+        es_handler_sptr h1( es_make_handler_print(es_handler_print::TYPE_F32) );
+        q->bind_handler( "soon_evt", h1 );
 
+        q->add_event( event_create( "soon_evt", 10, 100 ) );
+        q->add_event( event_create( "soon_evt", 20, 5 ) );
+        q->add_event( event_create( "soon_evt", 500, 5 ) );
+
+        es_eh_pair* eh;
+        CPPUNIT_ASSERT( q->fetch_next_event( 0, 50, &eh ) );
+        CPPUNIT_ASSERT_EQUAL( (uint64_t)20, (uint64_t)eh->time() );
+        delete eh;
+
+        // only the event at 10 is pending, 500 is past the window
+        CPPUNIT_ASSERT( !q->fetch_next_event( 0, 50, &eh ) );
+        CPPUNIT_ASSERT_EQUAL( (uint64_t)2, q->d_num_soon );
+
+        CPPUNIT_ASSERT( q->fetch_next_event( 0, 1000, &eh ) );
+        delete eh;
+        CPPUNIT_ASSERT( q->fetch_next_event( 0, 1000, &eh ) );
+        delete eh;
+        CPPUNIT_ASSERT( q->empty() );
+    }
+}
+
+// consumer and producer threads parking on a work queue
+class qa_work_queue_consumer {
+  public:
+    es_work_queue<int> *q;
+    int lane, item;
+    bool ok;
+    qa_work_queue_consumer(es_work_queue<int> *_q, int _lane) : q(_q), lane(_lane), item(-1), ok(false) {}
+    void operator()(){ ok = q->wait_pop(item, lane); }
+};
+
+class qa_work_queue_producer {
+  public:
+    es_work_queue<int> *q;
+    int item, lane;
+    bool ok;
+    qa_work_queue_producer(es_work_queue<int> *_q, int _item, int _lane) : q(_q), item(_item), lane(_lane), ok(false) {}
+    void operator()(){ ok = q->push_wait(item, lane); }
+};
+
+// Test that a producer released from push_wait() wakes a parked consumer
+void
+qa_es_common::t13()
+{
+    printf("t13\n");
+    es_work_queue<int> q(16);
+    q.set_policy(SCHEDULE_KEYED, 2);
+    q.set_limit(2);
+    CPPUNIT_ASSERT( q.push(1, 1) );
+    CPPUNIT_ASSERT( q.push(2, 1) );
+
+    // lane 0 is empty and keyed lanes are never stolen from
+    qa_work_queue_consumer consumer(&q, 0);
+    boost::thread ct(boost::ref(consumer));
+    for(int i=0; i<1000 && q.waiters() == 0; i++)
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    CPPUNIT_ASSERT_EQUAL( 1, q.waiters() );
+
+    qa_work_queue_producer producer(&q, 3, 0);
+    boost::thread pt(boost::ref(producer));
+    for(int i=0; i<1000 && q.producers() == 0; i++)
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    CPPUNIT_ASSERT_EQUAL( 1, q.producers() );
+
+    // room in lane 1 lets the producer through to lane 0's consumer
+    int item;
+    CPPUNIT_ASSERT( q.pop(item, 1) );
+    CPPUNIT_ASSERT_EQUAL( 1, item );
+    CPPUNIT_ASSERT( pt.try_join_for(boost::chrono::seconds(5)) );
+    CPPUNIT_ASSERT( producer.ok );
+    CPPUNIT_ASSERT( ct.try_join_for(boost::chrono::seconds(5)) );
+    CPPUNIT_ASSERT( consumer.ok );
+    CPPUNIT_ASSERT_EQUAL( 3, consumer.item );
+
+    CPPUNIT_ASSERT( q.pop(item, 1) );
+    CPPUNIT_ASSERT_EQUAL( 2, item );
+    CPPUNIT_ASSERT_EQUAL( (size_t)0, q.size() );
+}
+
+class qa_work_queue_drain {
+  public:
+    es_work_queue<int> *q;
+    int n;
+    long long sum;
+    bool ok;
+    qa_work_queue_drain(es_work_queue<int> *_q, int _n) : q(_q), n(_n), sum(0), ok(true) {}
+    void operator()(){
+        int item;
+        for(int i=0; i<n && ok; i++){
+            ok = q->wait_pop(item);
+            sum += item;
+        }
+    }
+};
+
+class qa_work_queue_fill {
+  public:
+    es_work_queue<int> *q;
+    int first, n;
+    bool ok;
+    qa_work_queue_fill(es_work_queue<int> *_q, int _first, int _n) : q(_q), first(_first), n(_n), ok(true) {}
+    void operator()(){
+        for(int i=first; i<first+n && ok; i++)
+            ok = q->push_wait(i);
+    }
+};
+
+// Test that many producers never lose the wakeup of a parked consumer
+void
+qa_es_common::t14()
+{
+    printf("t14\n");
+    const int nproducers = 8, nitems = 2000;
+    es_work_queue<int> q(16);
+    q.set_limit(4);
+
+    qa_work_queue_drain consumer(&q, nproducers*nitems);
+    boost::thread ct(boost::ref(consumer));
+    for(int i=0; i<1000 && q.waiters() == 0; i++)
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    CPPUNIT_ASSERT_EQUAL( 1, q.waiters() );
+
+    std::vector< boost::shared_ptr<qa_work_queue_fill> > producers;
+    boost::thread_group pt;
+    for(int p=0; p<nproducers; p++){
+        producers.push_back(boost::shared_ptr<qa_work_queue_fill>(new qa_work_queue_fill(&q, p*nitems, nitems)));
+        pt.create_thread(boost::ref(*producers.back()));
+    }
+    pt.join_all();
+    for(int p=0; p<nproducers; p++)
+        CPPUNIT_ASSERT( producers[p]->ok );
+
+    // every item arrives exactly once
+    CPPUNIT_ASSERT( ct.try_join_for(boost::chrono::seconds(5)) );
+    CPPUNIT_ASSERT( consumer.ok );
+    long long total = (long long)nproducers*nitems;
+    CPPUNIT_ASSERT_EQUAL( total*(total-1)/2, consumer.sum );
+    CPPUNIT_ASSERT_EQUAL( (size_t)0, q.size() );
+}
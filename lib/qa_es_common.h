@@ -8,10 +8,36 @@ class qa_es_common : public CppUnit::TestCase {
 
   CPPUNIT_TEST_SUITE (qa_es_common);
   CPPUNIT_TEST (t1);
+  CPPUNIT_TEST (t2);
+  CPPUNIT_TEST (t3);
+  CPPUNIT_TEST (t4);
+  CPPUNIT_TEST (t5);
+  CPPUNIT_TEST (t6);
+  CPPUNIT_TEST (t7);
+  CPPUNIT_TEST (t8);
+  CPPUNIT_TEST (t9);
+  CPPUNIT_TEST (t10);
+  CPPUNIT_TEST (t11);
+  CPPUNIT_TEST (t12);
+  CPPUNIT_TEST (t13);
+  CPPUNIT_TEST (t14);
   CPPUNIT_TEST_SUITE_END ();
 
  private:
   void t1 ();
+  void t2 ();
+  void t3 ();
+  void t4 ();
+  void t5 ();
+  void t6 ();
+  void t7 ();
+  void t8 ();
+  void t9 ();
+  void t10 ();
+  void t11 ();
+  void t12 ();
+  void t13 ();
+  void t14 ();
 };
 
 
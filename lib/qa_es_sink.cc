@@ -24,12 +24,102 @@
 #include <cppunit/TestAssert.h>
 
 #include <stdio.h>
+#include <sched.h>
+#include <set>
 #include <es/es.h>
+#include <es/es_affinity.h>
+#include <boost/thread.hpp>
 
 
 #include <gnuradio/top_block.h>
 #include <gnuradio/blocks/vector_source_f.h>
 
+// handler which checks its buffer holds the source ramp and records
+// where, how often and how many at once it was run
+class qa_sink_handler : public es_handler {
+    public:
+        qa_sink_handler(int sleep_ms = 0, bool native = false) :
+            gr::sync_block("qa_sink_handler",
+                gr::io_signature::make(0,0,0),
+                gr::io_signature::make(0,0,0)),
+            d_sleep_ms(sleep_ms), d_native(native), nrun(0), nbad(0), nactive(0), max_active(0) {}
+
+        bool native_buffers(){ return d_native; }
+
+        void handler(pmt_t msg, gr_vector_void_star buf){
+            {
+                boost::mutex::scoped_lock lock(d_mutex);
+                nactive++;
+                max_active = std::max(max_active, nactive);
+                threads.insert(boost::this_thread::get_id());
+                cpus.insert(sched_getcpu());
+            }
+            if(d_sleep_ms)
+                boost::this_thread::sleep_for(boost::chrono::milliseconds(d_sleep_ms));
+
+            uint64_t time = event_time(msg);
+            uint64_t length = event_length(msg);
+            const float* data = (const float*)buf[0];
+            bool ok = true;
+            for(uint64_t j=0; j<length; j++)
+                ok = ok && data[j] == (float)(time + j);
+            // without native buffers the event must hold a u8vector copy
+            if(!d_native)
+                ok = ok && pmt::is_u8vector(pmt::nth(0, event_field(msg, es::event_buffer)));
+
+            boost::mutex::scoped_lock lock(d_mutex);
+            nrun++;
+            nbad += ok ? 0 : 1;
+            nactive--;
+            types.insert(event_type(msg));
+            lengths[time] = length;
+            bufs[time] = buf[0];
+            if(event_has_field(msg, pmt::intern("seq")))
+                seqs[time] = pmt::to_long(event_field(msg, pmt::intern("seq")));
+            if(event_has_field(msg, pmt::intern("burst")))
+                tags[time] = pmt::to_uint64(pmt::car(event_field(msg, pmt::intern("burst"))));
+            if(event_has_field(msg, pmt::intern("old")))
+                olds.insert(time);
+        }
+
+        boost::mutex d_mutex;
+        int d_sleep_ms;
+        bool d_native;
+        int nrun, nbad, nactive, max_active;
+        std::set<boost::thread::id> threads;
+        std::set<int> cpus;
+        std::set<std::string> types;
+        std::map<uint64_t, uint64_t> lengths;   // length seen per event time
+        std::map<uint64_t, void*> bufs;         // buffer handed out per event time
+        std::map<uint64_t, long> seqs;          // seq arg seen per event time
+        std::map<uint64_t, uint64_t> tags;      // burst tag offset seen per event time
+        std::set<uint64_t> olds;                // event times which saw the old tag
+};
+
+// float ramp source (item i holds i) feeding a new sink
+static es_sink_sptr
+qa_ramp_sink(gr::top_block_sptr tb, size_t nitems, int n_threads,
+             enum es_congestion_behaviors cb = DROP)
+{
+    std::vector<float> vec(nitems);
+    for(size_t i=0; i<vec.size(); i++)
+        vec[i] = (float)i;
+    gr::blocks::vector_source_f::sptr src = gr::blocks::vector_source_f::make(vec);
+
+    gr_vector_int insig(1);
+    insig[0] = sizeof(float);
+    es_sink_sptr snk = es_make_sink( insig, n_threads, 64, DISCARD, SEARCH_BINARY, cb );
+    tb->connect( src, 0, snk, 0 );
+    return snk;
+}
+
+static void
+qa_add_events(es_queue_sptr q, std::string type, uint64_t first, uint64_t step, int n, uint64_t length)
+{
+    for(int i=0; i<n; i++)
+        q->add_event( event_create( type, first + i*step, length ) );
+}
+
 // Test gr-runtime operation of single event item
 void
 qa_es_sink::t1()
@@ -91,4 +181,559 @@ qa_es_sink::t1()
     printf(" *** END QA_ES_SINK_T1\n");
 }
 
+// Test that events reach their handler with their own time and length
+// and the stream data of their window, whatever order they were added in
+void
+qa_es_sink::t2()
+{
+    printf(" *** BEGIN QA_ES_SINK_T2\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t2_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 5000, 2, BLOCK);
+
+    boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler() );
+    snk->event_queue->register_event_type( "ramp_evt" );
+    snk->event_queue->bind_handler( "ramp_evt", h );
+    // event i at 200 + 400*i for 10*(i+1) items, added last to first
+    for(int i=9; i>=0; i--)
+        qa_add_events( snk->event_queue, "ramp_evt", 200 + 400*i, 0, 1, 10*(i+1) );
+    tb->run();
+
+    CPPUNIT_ASSERT_EQUAL( 10, h->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, h->nbad );
+    CPPUNIT_ASSERT_EQUAL( (size_t)10, h->lengths.size() );
+    for(int i=0; i<10; i++)
+        CPPUNIT_ASSERT_EQUAL( (uint64_t)(10*(i+1)), h->lengths[200 + 400*i] );
+    CPPUNIT_ASSERT_EQUAL( 0, snk->num_events() );
+    printf(" *** END QA_ES_SINK_T2\n");
+}
+
+// Test that args added to an event reach its handler next to the
+// native type, time and length fields
+void
+qa_es_sink::t3()
+{
+    printf(" *** BEGIN QA_ES_SINK_T3\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t3_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 5000, 2, BLOCK);
+
+    boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler() );
+    snk->event_queue->register_event_type( "arg_evt" );
+    snk->event_queue->bind_handler( "arg_evt", h );
+    for(int i=0; i<20; i++){
+        pmt_t evt = event_create( "arg_evt", 100 + 200*i, 50 );
+        evt = event_args_add( evt, pmt::intern("seq"), pmt::from_long(i) );
+        snk->event_queue->add_event( evt );
+    }
+    tb->run();
+
+    CPPUNIT_ASSERT_EQUAL( 20, h->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, h->nbad );
+    CPPUNIT_ASSERT( h->types.size() == 1 && *h->types.begin() == "arg_evt" );
+    CPPUNIT_ASSERT_EQUAL( (size_t)20, h->seqs.size() );
+    for(int i=0; i<20; i++)
+        CPPUNIT_ASSERT_EQUAL( (long)i, h->seqs[100 + 200*i] );
+    printf(" *** END QA_ES_SINK_T3\n");
+}
+
+// Test that events reach only the handlers bound to their type, and that
+// events of a registered type without handlers are dropped
+void
+qa_es_sink::t4()
+{
+    printf(" *** BEGIN QA_ES_SINK_T4\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t4_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 5000, 2, BLOCK);
+
+    boost::shared_ptr<qa_sink_handler> ha( new qa_sink_handler() );
+    boost::shared_ptr<qa_sink_handler> hb( new qa_sink_handler() );
+    snk->event_queue->register_event_type( "a_evt" );
+    snk->event_queue->register_event_type( "b_evt" );
+    snk->event_queue->register_event_type( "unbound_evt" );
+    snk->event_queue->bind_handler( "a_evt", ha );
+    snk->event_queue->bind_handler( "b_evt", hb );
+    qa_add_events( snk->event_queue, "a_evt", 100, 300, 10, 10 );
+    qa_add_events( snk->event_queue, "b_evt", 100, 300, 10, 20 );
+    qa_add_events( snk->event_queue, "unbound_evt", 150, 300, 10, 10 );
+    CPPUNIT_ASSERT_EQUAL( 20, snk->event_queue->length() );
+    tb->run();
 
+    CPPUNIT_ASSERT_EQUAL( 10, ha->nrun );
+    CPPUNIT_ASSERT_EQUAL( 10, hb->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, ha->nbad + hb->nbad );
+    CPPUNIT_ASSERT( ha->types.size() == 1 && *ha->types.begin() == "a_evt" );
+    CPPUNIT_ASSERT( hb->types.size() == 1 && *hb->types.begin() == "b_evt" );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)10, ha->lengths[400] );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)20, hb->lengths[400] );
+    CPPUNIT_ASSERT_EQUAL( 0, snk->num_events() );
+    printf(" *** END QA_ES_SINK_T4\n");
+}
+
+// handler which holds its thread until released
+class qa_gate_handler : public es_handler {
+    public:
+        qa_gate_handler() :
+            gr::sync_block("qa_gate_handler",
+                gr::io_signature::make(0,0,0),
+                gr::io_signature::make(0,0,0)),
+            d_open(false), nrun(0) {}
+
+        void handler(pmt_t msg, gr_vector_void_star buf){
+            boost::mutex::scoped_lock lock(d_mutex);
+            while(!d_open)
+                d_cond.wait(lock);
+            nrun++;
+        }
+        void release(){
+            boost::mutex::scoped_lock lock(d_mutex);
+            d_open = true;
+            d_cond.notify_all();
+        }
+
+        boost::mutex d_mutex;
+        boost::condition_variable d_cond;
+        bool d_open;
+        int nrun;
+};
+
+// Test that events added from several threads while the flowgraph runs
+// all reach the pool threads, the stream is held at a gated event until
+// every producer is done so none of their events can arrive late
+void
+qa_es_sink::t5()
+{
+    printf(" *** BEGIN QA_ES_SINK_T5\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t5_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 50000, 4, BLOCK);
+
+    boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler() );
+    boost::shared_ptr<qa_gate_handler> gate( new qa_gate_handler() );
+    snk->event_queue->register_event_type( "mt_evt" );
+    snk->event_queue->register_event_type( "gate_evt" );
+    snk->event_queue->bind_handler( "mt_evt", h );
+    snk->event_queue->bind_handler( "gate_evt", gate );
+    qa_add_events( snk->event_queue, "gate_evt", 0, 0, 1, 1 );
+
+    tb->start();
+    boost::thread_group producers;
+    for(int t=0; t<4; t++)
+        producers.create_thread( boost::bind(qa_add_events, snk->event_queue,
+            std::string("mt_evt"), 100 + t*10, 200, 200, 10) );
+    producers.join_all();
+    gate->release();
+    tb->wait();
+
+    CPPUNIT_ASSERT_EQUAL( 1, gate->nrun );
+    CPPUNIT_ASSERT_EQUAL( 800, h->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, h->nbad );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)0, snk->num_running_handlers() );
+    printf(" *** END QA_ES_SINK_T5\n");
+}
+
+// Test that several events starting on one sample each hold the stream
+// until they are done, and that no live event time is left behind
+void
+qa_es_sink::t6()
+{
+    printf(" *** BEGIN QA_ES_SINK_T6\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t6_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 5000, 2, BLOCK);
+
+    boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler(2) );
+    snk->event_queue->register_event_type( "live_evt" );
+    snk->event_queue->bind_handler( "live_evt", h );
+    qa_add_events( snk->event_queue, "live_evt", 1000, 0, 3, 10 );
+    qa_add_events( snk->event_queue, "live_evt", 1000, 0, 3, 50 );
+    qa_add_events( snk->event_queue, "live_evt", 2000, 100, 10, 20 );
+    tb->run(64);
+
+    CPPUNIT_ASSERT_EQUAL( 16, h->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, h->nbad );
+    CPPUNIT_ASSERT( snk->live_event_times.empty() );
+    CPPUNIT_ASSERT_EQUAL( 0, snk->num_events() );
+    printf(" *** END QA_ES_SINK_T6\n");
+}
+
+// Test that copies held by handlers never exceed the memory budget
+// and that events put back over it are still all handled
+void
+qa_es_sink::t7()
+{
+    printf(" *** BEGIN QA_ES_SINK_T7\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t7_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 10000, 4);
+
+    boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler(5) );
+    snk->event_queue->register_event_type( "budget_evt" );
+    snk->event_queue->bind_handler( "budget_evt", h );
+    qa_add_events( snk->event_queue, "budget_evt", 100, 200, 20, 100 );
+
+    // room for two 100 float copies at once
+    snk->set_memory_budget( 2*100*sizeof(float) );
+    tb->run();
+
+    CPPUNIT_ASSERT_EQUAL( 20, h->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, h->nbad );
+    CPPUNIT_ASSERT( h->max_active <= 2 );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)0, snk->inflight_bytes() );
+    printf(" *** END QA_ES_SINK_T7\n");
+}
+
+// Test that zero-copy events hold the stream so their view stays valid
+// while the handler runs, even with a budget which frees copied events,
+// and that handlers not reading buf natively still get copies
+void
+qa_es_sink::t8()
+{
+    printf(" *** BEGIN QA_ES_SINK_T8\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t8_top");
+    // several times the sink's history, so the upstream buffer wraps
+    es_sink_sptr snk = qa_ramp_sink(tb, 300000, 2, BLOCK);
+
+    boost::shared_ptr<qa_sink_handler> hn( new qa_sink_handler(1, true) );
+    boost::shared_ptr<qa_sink_handler> hc( new qa_sink_handler() );
+    snk->event_queue->register_event_type( "zc_evt" );
+    snk->event_queue->bind_handler( "zc_evt", hn );
+    snk->event_queue->bind_handler( "zc_evt", hc );
+    qa_add_events( snk->event_queue, "zc_evt", 500, 6000, 50, 100 );
+
+    snk->set_memory_budget( 1<<20 );
+    snk->set_zero_copy( "zc_evt" );
+    tb->run(512);
+
+    CPPUNIT_ASSERT_EQUAL( 50, hn->nrun );
+    CPPUNIT_ASSERT_EQUAL( 50, hc->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, hn->nbad + hc->nbad );
+    for(std::map<uint64_t, void*>::iterator it = hn->bufs.begin(); it != hn->bufs.end(); it++)
+        CPPUNIT_ASSERT( it->second != hc->bufs[it->first] );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)0, snk->inflight_bytes() );
+    printf(" *** END QA_ES_SINK_T8\n");
+}
+
+// Test that handlers of one event share a single copy which is given
+// back once both are done
+void
+qa_es_sink::t9()
+{
+    printf(" *** BEGIN QA_ES_SINK_T9\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t9_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 10000, 4, BLOCK);
+
+    boost::shared_ptr<qa_sink_handler> h1( new qa_sink_handler(1) );
+    boost::shared_ptr<qa_sink_handler> h2( new qa_sink_handler() );
+    snk->event_queue->register_event_type( "fan_evt" );
+    snk->event_queue->bind_handler( "fan_evt", h1 );
+    snk->event_queue->bind_handler( "fan_evt", h2 );
+    qa_add_events( snk->event_queue, "fan_evt", 100, 300, 20, 100 );
+
+    snk->set_memory_budget( 1<<20 );
+    tb->run();
+
+    CPPUNIT_ASSERT_EQUAL( 20, h1->nrun );
+    CPPUNIT_ASSERT_EQUAL( 20, h2->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, h1->nbad + h2->nbad );
+    CPPUNIT_ASSERT( h1->bufs == h2->bufs );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)0, snk->inflight_bytes() );
+    printf(" *** END QA_ES_SINK_T9\n");
+}
+
+// Test that coalesced span copies give native handlers intact views,
+// leave plain handlers their own copies and are given back once done
+void
+qa_es_sink::t10()
+{
+    printf(" *** BEGIN QA_ES_SINK_T10\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t10_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 10000, 4, BLOCK);
+
+    boost::shared_ptr<qa_sink_handler> hn( new qa_sink_handler(1, true) );
+    boost::shared_ptr<qa_sink_handler> hc( new qa_sink_handler() );
+    snk->event_queue->register_event_type( "span_evt" );
+    snk->event_queue->bind_handler( "span_evt", hn );
+    snk->event_queue->bind_handler( "span_evt", hc );
+    // overlapping windows, every 30 items for 100
+    qa_add_events( snk->event_queue, "span_evt", 1000, 30, 30, 100 );
+
+    snk->set_memory_budget( 1<<20 );
+    snk->set_coalesce_windows( true );
+    tb->run();
+
+    CPPUNIT_ASSERT_EQUAL( 30, hn->nrun );
+    CPPUNIT_ASSERT_EQUAL( 30, hc->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, hn->nbad + hc->nbad );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)0, snk->inflight_bytes() );
+    printf(" *** END QA_ES_SINK_T10\n");
+}
+
+static gr::tag_t
+qa_tag(uint64_t offset, std::string key)
+{
+    gr::tag_t tag;
+    tag.offset = offset;
+    tag.key = pmt::intern(key);
+    tag.value = pmt::from_uint64(offset);
+    tag.srcid = PMT_F;
+    return tag;
+}
+
+// Test that each event carries the tags in its window plus the latest one
+// before it, read from every input and not from tags long gone
+void
+qa_es_sink::t11()
+{
+    printf(" *** BEGIN QA_ES_SINK_T11\n");
+    std::vector<float> vec(10000);
+    for(size_t i=0; i<vec.size(); i++)
+        vec[i] = (float)i;
+    // all tags are on the second input
+    std::vector<gr::tag_t> tags;
+    tags.push_back(qa_tag(10, "old"));
+    for(uint64_t off=0; off<10000; off+=1000)
+        tags.push_back(qa_tag(off, "burst"));
+
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t11_top");
+    gr::blocks::vector_source_f::sptr src0 = gr::blocks::vector_source_f::make(vec);
+    gr::blocks::vector_source_f::sptr src1 = gr::blocks::vector_source_f::make(vec, false, 1, tags);
+    gr_vector_int insig(2, sizeof(float));
+    es_sink_sptr snk = es_make_sink( insig, 2, 64, DISCARD, SEARCH_BINARY, BLOCK );
+    tb->connect( src0, 0, snk, 0 );
+    tb->connect( src1, 0, snk, 1 );
+
+    boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler() );
+    snk->event_queue->register_event_type( "tag_evt" );
+    snk->event_queue->bind_handler( "tag_evt", h );
+    // no window crosses a tag, so each sees the last one before its start
+    qa_add_events( snk->event_queue, "tag_evt", 500, 700, 13, 50 );
+    // one crossing the tag at 3000
+    qa_add_events( snk->event_queue, "tag_evt", 2980, 0, 1, 50 );
+    tb->run(256);
+
+    CPPUNIT_ASSERT_EQUAL( 14, h->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, h->nbad );
+    // the old tag is the latest before the first event only
+    CPPUNIT_ASSERT( h->olds.size() == 1 && *h->olds.begin() == 500 );
+    CPPUNIT_ASSERT_EQUAL( (size_t)13, h->tags.size() );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)3000, h->tags[2980] );
+    for(std::map<uint64_t, uint64_t>::iterator it = h->tags.begin(); it != h->tags.end(); it++){
+        if(it->first != 2980)
+            CPPUNIT_ASSERT_EQUAL( (it->first/1000)*1000, it->second );
+    }
+    printf(" *** END QA_ES_SINK_T11\n");
+}
+
+// streaming handler which counts what the sink hands it
+class qa_sink_stream_handler : public es_handler, public es_stream_handler {
+    public:
+        qa_sink_stream_handler() :
+            gr::sync_block("qa_sink_stream_handler",
+                gr::io_signature::make(0,0,0),
+                gr::io_signature::make(0,0,0)),
+            nbegin(0), nchunks(0), nitems(0), nend(0), next(0) {}
+        // streams are serviced by work() itself, so this is its thread
+        void stream_begin(es_event &evt){ nbegin++; thread = boost::this_thread::get_id(); }
+        void stream_chunk(es_event &evt, uint64_t offset, gr_vector_const_void_star &buf, int n){
+            // chunks must follow on from each other and carry the source ramp
+            if(offset == next && ((const float*)buf[0])[0] == (float)(evt.time() + offset))
+                next += n;
+            nchunks++;
+            nitems += n;
+        }
+        void stream_end(es_event &evt){ nend++; }
+        int nbegin, nchunks, nitems, nend;
+        uint64_t next;
+        boost::thread::id thread;
+};
+
+// Test that a streaming event spanning many work() calls is begun once,
+// handed every item in order and ended once
+void
+qa_es_sink::t12()
+{
+    printf(" *** BEGIN QA_ES_SINK_T12\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t12_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 4000, 1);
+
+    boost::shared_ptr<qa_sink_stream_handler> h( new qa_sink_stream_handler() );
+    snk->event_queue->register_event_type( "long_evt" );
+    snk->event_queue->bind_handler( "long_evt", h );
+    snk->event_queue->add_event( event_create( "long_evt", 100, 3000 ) );
+
+    // at most 64 items per work() call
+    tb->run(64);
+
+    CPPUNIT_ASSERT_EQUAL( 1, h->nbegin );
+    CPPUNIT_ASSERT( h->nchunks > 1 );
+    CPPUNIT_ASSERT_EQUAL( 3000, h->nitems );
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)3000, h->next );
+    CPPUNIT_ASSERT_EQUAL( 1, h->nend );
+    CPPUNIT_ASSERT_EQUAL( 0, snk->num_events() );
+    printf(" *** END QA_ES_SINK_T12\n");
+}
+
+// Test that wait_events() times out while a handler is still running and
+// returns true once it has finished
+void
+qa_es_sink::t13()
+{
+    printf(" *** BEGIN QA_ES_SINK_T13\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t13_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 5000, 2);
+
+    boost::shared_ptr<qa_gate_handler> gate( new qa_gate_handler() );
+    snk->event_queue->register_event_type( "gate_evt" );
+    snk->event_queue->bind_handler( "gate_evt", gate );
+    qa_add_events( snk->event_queue, "gate_evt", 100, 0, 1, 10 );
+
+    tb->start();
+    for(int i=0; i<5000 && snk->num_running_handlers() == 0; i++)
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    CPPUNIT_ASSERT_EQUAL( (uint64_t)1, snk->num_running_handlers() );
+
+    CPPUNIT_ASSERT( !snk->wait_events(20) );
+    gate->release();
+    CPPUNIT_ASSERT( snk->wait_events(5000) );
+    tb->wait();
+
+    CPPUNIT_ASSERT_EQUAL( 1, gate->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, snk->num_events() );
+    printf(" *** END QA_ES_SINK_T13\n");
+}
+
+// Test that with no threads every handler runs on the work() thread, and
+// that inline types run there while the rest go to the pool
+void
+qa_es_sink::t14()
+{
+    printf(" *** BEGIN QA_ES_SINK_T14\n");
+    {
+        gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t14_nothreads_top");
+        es_sink_sptr snk = qa_ramp_sink(tb, 5000, 0);
+
+        boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler() );
+        boost::shared_ptr<qa_sink_stream_handler> s( new qa_sink_stream_handler() );
+        snk->event_queue->register_event_type( "inl_evt" );
+        snk->event_queue->register_event_type( "stream_evt" );
+        snk->event_queue->bind_handler( "inl_evt", h );
+        snk->event_queue->bind_handler( "stream_evt", s );
+        snk->event_queue->add_event( event_create( "stream_evt", 10, 4000 ) );
+        qa_add_events( snk->event_queue, "inl_evt", 100, 200, 20, 50 );
+        tb->run();
+
+        CPPUNIT_ASSERT_EQUAL( 20, h->nrun );
+        CPPUNIT_ASSERT_EQUAL( 0, h->nbad );
+        CPPUNIT_ASSERT_EQUAL( 1, s->nend );
+        CPPUNIT_ASSERT_EQUAL( (size_t)1, h->threads.size() );
+        CPPUNIT_ASSERT( *h->threads.begin() == s->thread );
+    }
+    {
+        gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t14_pertype_top");
+        es_sink_sptr snk = qa_ramp_sink(tb, 5000, 2);
+
+        boost::shared_ptr<qa_sink_handler> hi( new qa_sink_handler() );
+        boost::shared_ptr<qa_sink_handler> hp( new qa_sink_handler() );
+        boost::shared_ptr<qa_sink_stream_handler> s( new qa_sink_stream_handler() );
+        snk->event_queue->register_event_type( "inl_evt" );
+        snk->event_queue->register_event_type( "pool_evt" );
+        snk->event_queue->register_event_type( "stream_evt" );
+        snk->event_queue->bind_handler( "inl_evt", hi );
+        snk->event_queue->bind_handler( "pool_evt", hp );
+        snk->event_queue->bind_handler( "stream_evt", s );
+        snk->event_queue->add_event( event_create( "stream_evt", 10, 4000 ) );
+        qa_add_events( snk->event_queue, "inl_evt", 100, 200, 20, 50 );
+        qa_add_events( snk->event_queue, "pool_evt", 150, 200, 20, 50 );
+
+        snk->set_inline( "inl_evt" );
+        tb->run();
+
+        CPPUNIT_ASSERT_EQUAL( 20, hi->nrun );
+        CPPUNIT_ASSERT_EQUAL( 20, hp->nrun );
+        CPPUNIT_ASSERT_EQUAL( 0, hi->nbad + hp->nbad );
+        CPPUNIT_ASSERT_EQUAL( (size_t)1, hi->threads.size() );
+        CPPUNIT_ASSERT( *hi->threads.begin() == s->thread );
+        CPPUNIT_ASSERT( hp->threads.count(s->thread) == 0 );
+    }
+    printf(" *** END QA_ES_SINK_T14\n");
+}
+
+// Test that an autoscaled pool never runs more handlers at once than
+// max_threads and loses no events while growing and retiring
+void
+qa_es_sink::t15()
+{
+    printf(" *** BEGIN QA_ES_SINK_T15\n");
+    gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t15_top");
+    es_sink_sptr snk = qa_ramp_sink(tb, 20000, 1, BLOCK);
+
+    boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler(5) );
+    snk->event_queue->register_event_type( "scale_evt" );
+    snk->event_queue->bind_handler( "scale_evt", h );
+    qa_add_events( snk->event_queue, "scale_evt", 100, 100, 150, 20 );
+
+    snk->set_thread_limits( 1, 3, 20 );
+    tb->run();
+
+    CPPUNIT_ASSERT_EQUAL( 150, h->nrun );
+    CPPUNIT_ASSERT_EQUAL( 0, h->nbad );
+    CPPUNIT_ASSERT( h->max_active >= 1 && h->max_active <= 3 );
+    printf(" *** END QA_ES_SINK_T15\n");
+}
+
+// Test that handler threads run on the cpus they were placed on, and that
+// localizing pins work() to the first cpu's node and gives each thread
+// its own lane
+void
+qa_es_sink::t16()
+{
+    printf(" *** BEGIN QA_ES_SINK_T16\n");
+    {
+        int cpu = sched_getcpu();
+        gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t16_place_top");
+        es_sink_sptr snk = qa_ramp_sink(tb, 5000, 2);
+
+        boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler() );
+        snk->event_queue->register_event_type( "place_evt" );
+        snk->event_queue->bind_handler( "place_evt", h );
+        qa_add_events( snk->event_queue, "place_evt", 100, 200, 20, 50 );
+
+        snk->set_thread_affinity( std::vector<int>(1, cpu) );
+        tb->run();
+
+        CPPUNIT_ASSERT_EQUAL( 20, h->nrun );
+        CPPUNIT_ASSERT_EQUAL( (size_t)1, h->cpus.size() );
+        CPPUNIT_ASSERT_EQUAL( cpu, *h->cpus.begin() );
+    }
+    {
+        // every cpu we may run on
+        cpu_set_t mask;
+        CPPUNIT_ASSERT_EQUAL( 0, sched_getaffinity(0, sizeof(mask), &mask) );
+        std::vector<int> cpus;
+        for(int c=0; c<CPU_SETSIZE; c++){
+            if(CPU_ISSET(c, &mask))
+                cpus.push_back(c);
+        }
+
+        gr::top_block_sptr tb = gr::make_top_block("qa_es_sink_t16_local_top");
+        es_sink_sptr snk = qa_ramp_sink(tb, 5000, 2);
+
+        boost::shared_ptr<qa_sink_handler> h( new qa_sink_handler() );
+        snk->event_queue->register_event_type( "local_evt" );
+        snk->event_queue->bind_handler( "local_evt", h );
+        qa_add_events( snk->event_queue, "local_evt", 100, 200, 20, 50 );
+
+        snk->set_thread_affinity( cpus, true );
+        tb->run();
+
+        CPPUNIT_ASSERT_EQUAL( 20, h->nrun );
+        CPPUNIT_ASSERT_EQUAL( 0, h->nbad );
+        for(std::set<int>::iterator it = h->cpus.begin(); it != h->cpus.end(); it++)
+            CPPUNIT_ASSERT( std::find(cpus.begin(), cpus.end(), *it) != cpus.end() );
+        // without a known node nothing is localized
+        if(es_cpu_node(cpus[0]) >= 0){
+            CPPUNIT_ASSERT( snk->processor_affinity() == es_node_cpus(cpus, cpus[0]) );
+            CPPUNIT_ASSERT_EQUAL( 2, snk->qq.nlanes() );
+        } else {
+            CPPUNIT_ASSERT( snk->processor_affinity().empty() );
+            CPPUNIT_ASSERT_EQUAL( 0, snk->qq.nlanes() );
+        }
+    }
+    printf(" *** END QA_ES_SINK_T16\n");
+}
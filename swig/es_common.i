@@ -39,6 +39,7 @@ class es {
         static pmt_t event_time;
         static pmt_t event_length;
         static pmt_t event_buffer;
+        static pmt_t event_deadline;
 
         // common event types
         static pmt_t event_type_1;
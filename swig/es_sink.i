@@ -24,16 +24,31 @@ GR_SWIG_BLOCK_MAGIC(es,sink);
 %include "std_string.i"
 %include "std_vector.i"
 
-es_sink_sptr es_make_sink (std::vector<int> insig, int n_threads, int sample_history_in_kilosamples=64, enum es_queue_early_behaviors eb = DISCARD, enum es_search_behaviors sb = SEARCH_BINARY, enum es_congestion_behaviors = DROP);
+es_sink_sptr es_make_sink (std::vector<int> insig, int n_threads, int sample_history_in_kilosamples=64, enum es_queue_early_behaviors eb = DISCARD, enum es_search_behaviors sb = SEARCH_BINARY, enum es_congestion_behaviors = DROP, enum es_scheduling_policies sp = SCHEDULE_FIFO, int queue_capacity = 100);
 
 class es_sink : public gr::sync_block
 {
-  es_sink (std::vector<int> insig, int n_threads, int sample_history_in_kilosamples=64, enum es_queue_early_behaviors eb = DISCARD, enum es_search_behaviors sb = SEARCH_BINARY, enum es_congestion_behaviors = DROP);   // private constructor
+  es_sink (std::vector<int> insig, int n_threads, int sample_history_in_kilosamples=64, enum es_queue_early_behaviors eb = DISCARD, enum es_search_behaviors sb = SEARCH_BINARY, enum es_congestion_behaviors = DROP, enum es_scheduling_policies sp = SCHEDULE_FIFO, int queue_capacity = 100);   // private constructor
 
   es_queue_sptr event_queue;
   unsigned long long d_time;
   unsigned int d_history;
 
 public:
-  void wait_events();
+  bool wait_events(int timeout_ms = 0);
+  void set_memory_budget(uint64_t nbytes);
+  uint64_t memory_budget();
+  void set_zero_copy(std::string type, bool enable = true);
+  void set_inline(std::string type, bool enable = true);
+  void set_order_key(std::string field);
+  void set_thread_limits(int min_threads, int max_threads, int idle_ms = 500);
+  int num_threads();
+  void set_thread_affinity(std::vector<int> cpus, bool localize = false);
+  std::string thread_placement();
+  void set_coalesce_windows(bool enable);
+  bool coalesce_windows();
+  void set_external_history(uint64_t nitems, bool hugepages = false);
+  uint64_t external_history();
+  uint64_t num_steals();
+  void set_executor(es_executor_sptr executor, int weight = 1);
 };
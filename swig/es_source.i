@@ -26,14 +26,17 @@ GR_SWIG_BLOCK_MAGIC(es,source);
 
 
 
-es_source_sptr es_make_source ( std::vector<int> out_sig, int nthreads, enum es_queue_early_behaviors eb = DISCARD);
+es_source_sptr es_make_source ( std::vector<int> out_sig, int nthreads, enum es_queue_early_behaviors eb = DISCARD, enum es_scheduling_policies sp = SCHEDULE_FIFO, int queue_capacity = 100);
 
 class es_source : public gr::sync_block
 {
 public:
   void set_max(unsigned long long maxlen);
   unsigned long long time();
+  void set_executor(es_executor_sptr executor, int weight = 1);
+  void set_inline(std::string type, bool enable = true);
+  void set_thread_affinity(std::vector<int> cpus);
 
 private:
-  es_source ( std::vector<int> out_sig, int nthreads, enum es_queue_early_behaviors eb = DISCARD);
+  es_source ( std::vector<int> out_sig, int nthreads, enum es_queue_early_behaviors eb = DISCARD, enum es_scheduling_policies sp = SCHEDULE_FIFO, int queue_capacity = 100);
 };
@@ -32,6 +32,7 @@ namespace std {
 #include "es/es_queue.h"
 #include "es/es_source.h"
 #include "es/es_sink.h"
+#include "es/es_executor.h"
 #include "es/es_common.h"
 #include "es/es_gen_vector.h"
 #include "es/es_handler.h"
@@ -53,6 +54,7 @@ namespace std {
 %include "es/es_handler_pdu.h"
 %include "es_handler.i"
 %include "es_event.i"
+%include "es_executor.i"
 %include "es_source.i"
 %include "es_sink.i"
 %include "es_common.i"